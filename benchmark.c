@@ -37,8 +37,11 @@ int main(int argc, char *argv[])
     }
     else{
         ;
-      #ifdef PBS
-        set_priority(100-(20+j),pid); // will only matter for PBS, comment it out if not implemented yet (better priorty for more IO intensive jobs)
+      #if defined(PBS) || defined(CFS)
+        set_priority(100-(20+j),pid); // will only matter for PBS and CFS, comment it out if not implemented yet (better priorty for more IO intensive jobs)
+      #endif
+      #ifdef STRIDE
+        set_tickets(10*(j+1),pid); // shares 1:2:...:10, compare with ps
       #endif
     }
   }
@@ -13,6 +13,11 @@
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
 //
+// Buffers are allocated from a slab cache.  When no unused
+// buffer can be recycled, or while there are fewer than NBUF,
+// bget() allocates another; brelse() frees unused buffers
+// again while there are more than NBUF.
+//
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
@@ -25,10 +30,12 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "slab.h"
 
 struct {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct slabcache cache;
+  int nbuf;                     // Buffers allocated
 
   // Linked list of all buffers, through prev/next.
   // head.next is most recently used.
@@ -38,21 +45,13 @@ struct {
 void
 binit(void)
 {
-  struct buf *b;
-
   initlock(&bcache.lock, "bcache");
+  slabinit(&bcache.cache, "buf", sizeof(struct buf));
 
 //PAGEBREAK!
-  // Create linked list of buffers
+  // Create an empty linked list of buffers
   bcache.head.prev = &bcache.head;
   bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
 }
 
 // Look through buffer cache for block on device dev.
@@ -75,21 +74,34 @@ bget(uint dev, uint blockno)
     }
   }
 
-  // Not cached; recycle an unused buffer.
+  // Not cached; recycle an unused buffer once there are NBUF.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if(bcache.nbuf >= NBUF){
+    for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
+      if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+        goto found;
     }
   }
-  panic("bget: no buffers");
+
+  // Allocate another, least recently used until it is released.
+  if((b = slaballoc(&bcache.cache)) == 0)
+    panic("bget: no buffers");
+  initsleeplock(&b->lock, "buffer");
+  b->next = &bcache.head;
+  b->prev = bcache.head.prev;
+  bcache.head.prev->next = b;
+  bcache.head.prev = b;
+  bcache.nbuf++;
+
+found:
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  release(&bcache.lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -131,10 +143,16 @@ brelse(struct buf *b)
     // no one is waiting for it.
     b->next->prev = b->prev;
     b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    if(bcache.nbuf > NBUF && (b->flags & B_DIRTY) == 0){
+      // grown past NBUF under load; shrink back.
+      bcache.nbuf--;
+      slabfree(&bcache.cache, b);
+    } else {
+      b->next = bcache.head.next;
+      b->prev = &bcache.head;
+      bcache.head.next->prev = b;
+      bcache.head.next = b;
+    }
   }
   
   release(&bcache.lock);
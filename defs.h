@@ -1,6 +1,7 @@
 struct buf;
 struct context;
 struct file;
+struct files;
 struct inode;
 struct pipe;
 struct proc;
@@ -9,6 +10,8 @@ struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct slabcache;
+struct timer;
 
 // bio.c
 void            binit(void);
@@ -30,6 +33,10 @@ struct file*    filealloc(void);
 void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
+struct files*   filesalloc(struct inode*);
+struct files*   filescopy(struct files*);
+struct files*   filesdup(struct files*);
+void            filesput(struct files*);
 int             fileread(struct file*, char*, int n);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
@@ -40,6 +47,7 @@ int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
+void            icacheinit(void);
 void            iinit(int dev);
 void            ilock(struct inode*);
 void            iput(struct inode*);
@@ -53,6 +61,11 @@ int             readi(struct inode*, char*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(int*, int);
+int             futexwake(int*, int);
+
 // ide.c
 void            ideinit(void);
 void            ideintr(void);
@@ -66,8 +79,16 @@ void            ioapicinit(void);
 // kalloc.c
 char*           kalloc(void);
 void            kfree(char*);
+char*           kalloc_pages(int);
+char*           kalloc_zeroed(void);
+int             kzeroidle(void);
+void            kfree_pages(char*, int);
+void            kref(char*);
+int             krefcount(char*);
+void            kallocdump(void);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+extern uint     phystop;
 
 // kbd.c
 void            kbdintr(void);
@@ -76,8 +97,13 @@ void            kbdintr(void);
 void            cmostime(struct rtcdate *r);
 int             lapicid(void);
 extern volatile uint*    lapic;
+extern int      hz;
+extern int      tickless;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
+void            lapiconeshot(uint);
+void            lapicperiodic(void);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
@@ -96,6 +122,7 @@ void            picenable(int);
 void            picinit(void);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
@@ -103,15 +130,19 @@ int             pipewrite(struct pipe*, char*, int);
 
 //PAGEBREAK: 16
 // proc.c
+int             clone(void(*)(void*, void*), void*, void*, void*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             join(void**);
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+void            replacevm(pde_t*, uint);
+int             reschedintr(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
@@ -119,10 +150,17 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
+int             wakeupn(void*, int);
 void            yield(void);
 int             waitx(int*, int*); // custom system call
 void            procdetails(void); // custom system call
 int             set_priority(int, int); // custom system call
+int             set_tickets(int, int); // custom system call
+int             set_deadline(int, int, int, int); // custom system call
+int             set_affinity(int, int); // custom system call
+int             set_clock(int, int, int); // custom system call
+extern int      quantum;
+int             get_affinity(int); // custom system call
 
 // swtch.S
 void            swtch(struct context**, struct context*);
@@ -136,6 +174,12 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// slab.c
+void            slabinit(struct slabcache*, char*, uint);
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+void            slabdump(void);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -160,7 +204,9 @@ int             fetchstr(uint, char**);
 void            syscall(void);
 
 // timer.c
-void            timerinit(void);
+void            timeradd(struct timer*, uint);
+void            timerdel(struct timer*);
+void            timerexpire(void);
 
 // trap.c
 void            idtinit(void);
@@ -184,6 +230,11 @@ void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
+pde_t*          cowuvm(pde_t*, uint);
+int             uncowuvm(pde_t*, uint);
+int             cowfault(pde_t*, uint);
+int             lazyfault(pde_t*, uint, uint);
+int             lazyuvm(pde_t*, uint, uint, uint);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
@@ -9,35 +9,40 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
+
+// Open files come from a slab cache, and go back to it when
+// the last reference is closed.  ftable.lock protects the
+// reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
+  struct slabcache cache;
 } ftable;
 
+// Tables of open files, one per process or group of threads.
+static struct slabcache filescache;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  slabinit(&ftable.cache, "file", sizeof(struct file));
+  slabinit(&filescache, "files", sizeof(struct files));
 }
 
 // Allocate a file structure.
+// Returns 0 if there is no memory.
 struct file*
 filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = slaballoc(&ftable.cache)) == 0)
+    return 0;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,6 +74,7 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_NONE;
   release(&ftable.lock);
+  slabfree(&ftable.cache, f);
 
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
@@ -79,6 +85,74 @@ fileclose(struct file *f)
   }
 }
 
+// Allocate a table with no open files, in directory cwd,
+// taking over the caller's reference to cwd.
+// Returns 0 if there is no memory.
+struct files*
+filesalloc(struct inode *cwd)
+{
+  struct files *fs;
+
+  if((fs = slaballoc(&filescache)) == 0)
+    return 0;
+  initlock(&fs->lock, "files");
+  fs->ref = 1;
+  fs->cwd = cwd;
+  return fs;
+}
+
+// Make a new table with the same open files and directory
+// as fs, for fork().  Returns 0 if there is no memory.
+struct files*
+filescopy(struct files *fs)
+{
+  struct files *nfs;
+  int fd;
+
+  if((nfs = filesalloc(0)) == 0)
+    return 0;
+  acquire(&fs->lock);
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fs->ofile[fd])
+      nfs->ofile[fd] = filedup(fs->ofile[fd]);
+  nfs->cwd = idup(fs->cwd);
+  release(&fs->lock);
+  return nfs;
+}
+
+// Add a process to those sharing fs, for clone().
+struct files*
+filesdup(struct files *fs)
+{
+  acquire(&fs->lock);
+  fs->ref++;
+  release(&fs->lock);
+  return fs;
+}
+
+// Drop a process's use of fs, closing its files if it was
+// the last one.
+void
+filesput(struct files *fs)
+{
+  int fd;
+
+  acquire(&fs->lock);
+  if(--fs->ref > 0){
+    release(&fs->lock);
+    return;
+  }
+  release(&fs->lock);
+
+  for(fd = 0; fd < NOFILE; fd++)
+    if(fs->ofile[fd])
+      fileclose(fs->ofile[fd]);
+  begin_op();
+  iput(fs->cwd);
+  end_op();
+  slabfree(&filescache, fs);
+}
+
 // Get metadata about file f.
 int
 filestat(struct file *f, struct stat *st)
@@ -8,12 +8,25 @@ struct file {
   uint off;
 };
 
+// A process's open files and current directory.  Threads made
+// by clone() share their creator's; fork() gives the child a
+// copy.  lock protects ofile and cwd.
+struct files {
+  struct spinlock lock;
+  int ref;                     // Processes using it
+  struct file *ofile[NOFILE];  // Open files
+  struct inode *cwd;           // Current directory
+};
+
 
 // in-memory copy of an inode
 struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // Next in its icache hash chain
+  struct inode *next; // LRU list of unused entries, while ref is 0
+  struct inode *prev;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
@@ -14,12 +14,13 @@
 #include "param.h"
 #include "stat.h"
 #include "mmu.h"
-#include "proc.h"
 #include "spinlock.h"
+#include "proc.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
@@ -119,12 +120,12 @@ bfree(int dev, uint b)
 //   is non-zero. ialloc() allocates, and iput() frees if
 //   the reference and link counts have fallen to zero.
 //
-// * Referencing in cache: an entry in the inode cache
-//   is free if ip->ref is zero. Otherwise ip->ref tracks
-//   the number of in-memory pointers to the entry (open
-//   files and current directories). iget() finds or
-//   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+// * Referencing in cache: ip->ref tracks the number of
+//   in-memory pointers to a cache entry (open files and
+//   current directories). iget() finds or creates a cache
+//   entry and increments its ref; iput() decrements ref.
+//   An entry whose ref has fallen to zero stays cached, on
+//   an LRU list, until there are more than NINODE such.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
@@ -154,30 +155,49 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The icache.lock spin-lock protects the allocation of icache
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold icache.lock while using any of those fields.
+// Entries are allocated from a slab cache and kept in a hash
+// table by dev and inum.  The icache.lock spin-lock protects
+// the allocation of icache entries, the hash chains and the
+// LRU list.  Since
+// ip->ref indicates whether an entry is in use, and ip->dev
+// and ip->inum indicate which i-node an entry holds, one must
+// hold icache.lock while using any of those fields.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 64  // buckets in the inode cache hash table
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slabcache cache;
+  struct inode *hash[NIHASH];
+  int nunused;                  // Entries with ref 0
+
+  // List of entries with ref 0, through prev/next.
+  // lru.next is most recently used.
+  struct inode lru;
 } icache;
 
+static struct inode**
+ihash(uint dev, uint inum)
+{
+  return &icache.hash[(dev * 31 + inum) % NIHASH];
+}
+
 void
-iinit(int dev)
+icacheinit(void)
 {
-  int i = 0;
-  
   initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  slabinit(&icache.cache, "inode", sizeof(struct inode));
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+}
 
+void
+iinit(int dev)
+{
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
@@ -241,36 +261,52 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **hp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  hp = ihash(dev, inum);
+  for(ip = *hp; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0){
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+        icache.nunused--;
+      }
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  // Allocate an inode cache entry.
+  if((ip = slaballoc(&icache.cache)) == 0)
+    panic("iget: no memory");
+  initsleeplock(&ip->lock, "inode");
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->hnext = *hp;
+  *hp = ip;
   release(&icache.lock);
 
   return ip;
 }
 
+// Take ip, which has no references, out of the hash table
+// and free it.  Caller must hold icache.lock.
+static void
+ifree(struct inode *ip)
+{
+  struct inode **hp;
+
+  for(hp = ihash(ip->dev, ip->inum); *hp != ip; hp = &(*hp)->hnext)
+    ;
+  *hp = ip->hnext;
+  slabfree(&icache.cache, ip);
+}
+
 // Increment reference count for ip.
 // Returns ip to enable ip = idup(ip1) idiom.
 struct inode*
@@ -322,8 +358,9 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode cache entry can
-// be recycled.
+// If that was the last reference, the inode cache entry is
+// kept on the LRU list, unless it is not valid, and the
+// least recently used one is freed once there are too many.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -331,6 +368,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  int valid;
+
   acquiresleep(&ip->lock);
   if(ip->valid && ip->nlink == 0){
     acquire(&icache.lock);
@@ -344,10 +383,29 @@ iput(struct inode *ip)
       ip->valid = 0;
     }
   }
+  valid = ip->valid;
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0){
+    if(!valid)
+      ifree(ip);
+    else {
+      // keep it cached, as most recently used
+      ip->next = icache.lru.next;
+      ip->prev = &icache.lru;
+      icache.lru.next->prev = ip;
+      icache.lru.next = ip;
+      if(++icache.nunused > NINODE){
+        // too many unused; free the least recently used
+        ip = icache.lru.prev;
+        ip->next->prev = ip->prev;
+        ip->prev->next = ip->next;
+        icache.nunused--;
+        ifree(ip);
+      }
+    }
+  }
   release(&icache.lock);
 }
 
@@ -625,11 +683,16 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct files *fs;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    fs = myproc()->files;
+    acquire(&fs->lock);
+    ip = idup(fs->cwd);
+    release(&fs->lock);
+  }
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
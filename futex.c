@@ -0,0 +1,95 @@
+// Futexes: blocking wait and wake on a word of user memory.
+//
+// A user-space lock only needs the kernel when it is
+// contended: futexwait() sleeps only if the word still holds
+// the value the caller saw, and futexwake() wakes sleepers.
+// Waiters are keyed on the kernel address of the word, which
+// maps one to one to its physical address, so processes and
+// threads sharing the page meet on the same key wherever it
+// is mapped.  They sleep in the ordinary sleep queues; the
+// locks here make checking the word and going to sleep
+// atomic with respect to a wake.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "proc.h"
+
+#define NFUTEX 64  // lock buckets
+
+static struct spinlock futexlock[NFUTEX];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEX; i++)
+    initlock(&futexlock[i], "futex");
+}
+
+// The kernel address of the word at user address uaddr
+// in the current process, or 0 if it is not valid.
+static int*
+futexkey(int *uaddr)
+{
+  struct proc *p = myproc();
+  char *page;
+
+  if((uint)uaddr % sizeof(int) || (uint)uaddr >= p->sz ||
+     (uint)uaddr + sizeof(int) > p->sz)
+    return 0;
+  if(lazyuvm(p->pgdir, (uint)uaddr, sizeof(int), p->sz) < 0)
+    return 0;
+  if((page = uva2ka(p->pgdir, (char*)uaddr)) == 0)
+    return 0;
+  return (int*)(page + ((uint)uaddr & (PGSIZE-1)));
+}
+
+static struct spinlock*
+futexq(int *key)
+{
+  return &futexlock[(((uint)key * 2654435761U) >> 16) % NFUTEX];
+}
+
+// Sleep until woken by futexwake(uaddr), if *uaddr == val.
+// Returns 0 when woken, or -1 at once if *uaddr != val, the
+// address is bad, or the process has been killed.
+int
+futexwait(int *uaddr, int val)
+{
+  struct spinlock *lk;
+  int *key;
+
+  if((key = futexkey(uaddr)) == 0)
+    return -1;
+  lk = futexq(key);
+  acquire(lk);
+  if(*key != val || myproc()->killed){
+    release(lk);
+    return -1;
+  }
+  sleep(key, lk);
+  release(lk);
+  return 0;
+}
+
+// Wake at most n processes waiting on uaddr, longest waiting
+// first.  Returns how many were woken, or -1 if uaddr is bad.
+int
+futexwake(int *uaddr, int n)
+{
+  struct spinlock *lk;
+  int *key, woken;
+
+  if((key = futexkey(uaddr)) == 0)
+    return -1;
+  lk = futexq(key);
+  acquire(lk);
+  woken = wakeupn(key, n);
+  release(lk);
+  return woken;
+}
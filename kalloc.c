@@ -1,6 +1,38 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// and pipe buffers. Allocates 4096-byte pages, and with
+// kalloc_pages() physically contiguous blocks of 2^order
+// pages, up to MAXORDER.
+//
+// Each page has a reference count, so that fork() can share
+// user pages copy-on-write.  kalloc() returns a page with one
+// reference, kref() adds one, and kfree() drops one, freeing
+// the page when none are left.  The counts are changed with
+// atomic instructions, not under a lock.
+//
+// Free pages are kept in a global pool under kmem.lock, and
+// each cpu caches some of its own.  kalloc() and kfree() use
+// the cpu's cache, and only go to the pool to refill it or
+// drain it, KBATCH pages at a time.  A cpu that finds the pool
+// empty too steals a page from another cpu's cache.
+//
+// The pool is a buddy allocator.  A free block of order k is
+// 2^k pages aligned to its size, and is on freelist[k].  Its
+// buddy is the block it was split from, or can be merged with:
+// the one whose page number differs only in bit k.  A block
+// is split as often as needed to make a smaller one, and
+// merged with its buddy again when both are free.
+//
+// Only the pages the BIOS memory map says are RAM are freed,
+// up to phystop, the top of the usable memory below PHYSTOP.
+//
+// Freed pages are not cleared; with KDEBUG they are filled with
+// junk.  An idle cpu zeroes free pages from its cache into a
+// list of its own (see kzeroidle), and kalloc_zeroed() takes
+// pages from there, so most pages are not zeroed on the paths
+// that need them.  kalloc_pages() empties the cpus' caches and
+// zeroed pages back into the pool before it gives up, so that
+// their buddies can merge.
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +40,12 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "proc.h"
+
+#define KBATCH 32  // pages moved between a cpu's cache and the pool at once
+#define KZMAX 256  // zeroed pages an idle cpu keeps ready
+#define KZLOW 8    // idle cpus stop zeroing below 1/KZLOW of RAM in the pool
+#define NPAGE (PHYSTOP/PGSIZE)
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -15,23 +53,128 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;             // Only on the pool's freelists
+};
+
+// An entry in the memory map bootasm.S got from the BIOS.
+struct e820entry {
+  uint addr;
+  uint addrhi;
+  uint len;
+  uint lenhi;
+  uint type;
+};
+#define E820_RAM 1              // Usable RAM
+
+static struct e820entry *e820;  // The map, or 0 if there was none
+static int ne820;
+uint phystop;                   // Top of the physical memory used
+
+// A cpu's cache of free pages.  Its lock is only contended
+// when another cpu steals from it.
+struct kcache {
+  struct spinlock lock;
+  struct run *freelist;
+  int nfree;
+  uint hits;                    // kalloc()s served from the cache
+  uint refills;                 // Batches taken from the pool
+  uint drains;                  // Batches given back to the pool
+  uint steals;                  // Pages taken from other cpus
+  struct run *zerolist;         // Zeroed pages, but for next
+  int nzero;
+  uint zeroed;                  // Pages zeroed while idle
+  uint zhits;                   // kalloc_zeroed()s served already zeroed
+  uint zmisses;                 // and zeroed on the spot
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run *freelist[MAXORDER+1];
+  int nblock[MAXORDER+1];       // Blocks on each freelist
+  int nfree;                    // Pages in the pool
+  int npage;                    // Pages of RAM handed to the allocator
+  uint contended;               // Times lock was found held
+  uint splits;                  // Blocks split in two
+  uint merges;                  // Buddies merged back together
+  uint reclaims;                // Times the cpus' caches were emptied
+  struct kcache cache[NCPU];
+  ushort ref[NPAGE];            // References to each physical page
+  uchar order[NPAGE];           // 1+order if first page of a free block
 } kmem;
 
+// Read the memory map bootasm.S left at E820MAP, and set
+// phystop to the top of the RAM in it below PHYSTOP.  Without
+// a sensible map, assume there are PHYSDEF bytes of RAM.
+static void
+e820init(void)
+{
+  struct e820entry *e;
+  uint n, top;
+
+  n = *(ushort*)P2V(E820MAP);
+  e820 = (struct e820entry*)P2V(E820MAP+4);
+  ne820 = (n - (E820MAP+4)) / sizeof(*e820);
+  if(n <= E820MAP+4 || ne820 > E820MAX ||
+     (n - (E820MAP+4)) % sizeof(*e820) != 0){
+    e820 = 0;
+    ne820 = 0;
+  }
+
+  phystop = 0;
+  for(e = e820; e < &e820[ne820]; e++){
+    if(e->type != E820_RAM || e->addrhi != 0 || e->addr >= PHYSTOP)
+      continue;
+    top = e->addr + e->len;
+    if(e->lenhi != 0 || top < e->addr || top > PHYSTOP)
+      top = PHYSTOP;
+    if(top > phystop)
+      phystop = top;
+  }
+  phystop = PGROUNDDOWN(phystop);
+  if(phystop < 4*1024*1024){
+    e820 = 0;
+    ne820 = 0;
+    phystop = PHYSDEF;
+  }
+}
+
+// Is the page at physical address pa usable RAM?
+static int
+isram(uint pa)
+{
+  struct e820entry *e;
+
+  if(pa + PGSIZE > phystop)
+    return 0;
+  if(e820 == 0)
+    return 1;
+  for(e = e820; e < &e820[ne820]; e++){
+    if(e->type == E820_RAM && e->addrhi == 0 && e->addr <= pa &&
+       (e->lenhi != 0 || pa + PGSIZE - e->addr <= e->len))
+      return 1;
+  }
+  return 0;
+}
+
 // Initialization happens in two phases.
 // 1. main() calls kinit1() while still using entrypgdir to place just
 // the pages mapped by entrypgdir on free list.
 // 2. main() calls kinit2() with the rest of the physical pages
 // after installing a full page table that maps them on all cores.
+// Until then there is one cpu and no cpuid(), so the pool is
+// used directly.
+// kinit1() also reads the memory map, which kvmalloc() needs
+// to know how much memory to map.
 void
 kinit1(void *vstart, void *vend)
 {
+  struct kcache *kc;
+
+  e820init();
   initlock(&kmem.lock, "kmem");
+  for(kc = kmem.cache; kc < &kmem.cache[NCPU]; kc++)
+    initlock(&kc->lock, "kcache");
   kmem.use_lock = 0;
   freerange(vstart, vend);
 }
@@ -41,39 +184,254 @@ kinit2(void *vstart, void *vend)
 {
   freerange(vstart, vend);
   kmem.use_lock = 1;
+  cprintf("mem: top %d MB, %d BIOS map entries, %d pages of RAM, %d free\n",
+          phystop >> 20, ne820, kmem.npage + V2P(end)/PGSIZE, kmem.nfree);
 }
 
+// Free the pages of RAM from vstart to vend, skipping holes.
 void
 freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    if(!isram(V2P(p)))
+      continue;
+    kmem.ref[V2P(p)/PGSIZE] = 1;
+    kmem.npage++;
     kfree(p);
+  }
+}
+
+// Take kmem.lock, counting the times another cpu has it.
+static void
+lockpool(void)
+{
+  if(!kmem.use_lock)
+    return;
+  if(kmem.lock.locked)
+    kmem.contended++;
+  acquire(&kmem.lock);
+}
+
+static void
+unlockpool(void)
+{
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+static void
+pushblock(struct run *r, int order)
+{
+  r->prev = 0;
+  r->next = kmem.freelist[order];
+  if(r->next)
+    r->next->prev = r;
+  kmem.freelist[order] = r;
+  kmem.nblock[order]++;
+  kmem.order[V2P(r)/PGSIZE] = order + 1;
+}
+
+static void
+unlinkblock(struct run *r, int order)
+{
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    kmem.freelist[order] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  kmem.nblock[order]--;
+  kmem.order[V2P(r)/PGSIZE] = 0;
 }
+
+// Take a block of 2^order pages from the pool, splitting
+// a larger one if need be.  Returns 0 if there is none.
+// Caller holds kmem.lock.
+static struct run*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k <= MAXORDER && kmem.freelist[k] == 0; k++)
+    ;
+  if(k > MAXORDER)
+    return 0;
+  r = kmem.freelist[k];
+  unlinkblock(r, k);
+  // Give back the upper half until the block is the right size.
+  while(k > order){
+    k--;
+    pushblock((struct run*)((char*)r + (PGSIZE << k)), k);
+    kmem.splits++;
+  }
+  kmem.nfree -= 1 << order;
+  return r;
+}
+
+// Return the block of 2^order pages at v to the pool,
+// merging it with its buddy for as long as that is free.
+// Caller holds kmem.lock.
+static void
+buddyfree(char *v, int order)
+{
+  uint pn, buddy;
+
+  kmem.nfree += 1 << order;
+  pn = V2P(v)/PGSIZE;
+  while(order < MAXORDER){
+    buddy = pn ^ (1 << order);
+    if(buddy >= NPAGE || kmem.order[buddy] != order + 1)
+      break;
+    unlinkblock((struct run*)P2V(buddy*PGSIZE), order);
+    pn &= ~(1 << order);
+    order++;
+    kmem.merges++;
+  }
+  pushblock((struct run*)P2V(pn*PGSIZE), order);
+}
+
+// Move up to n pages from the pool to kc.
+// Caller holds kc->lock.
+static void
+refill(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  lockpool();
+  for(; n > 0 && (r = buddyalloc(0)) != 0; n--){
+    r->next = kc->freelist;
+    kc->freelist = r;
+    kc->nfree++;
+  }
+  unlockpool();
+  kc->refills++;
+}
+
+// Move n pages from kc to the pool.
+// Caller holds kc->lock.
+static void
+drain(struct kcache *kc, int n)
+{
+  struct run *r;
+
+  lockpool();
+  for(; n > 0 && (r = kc->freelist) != 0; n--){
+    kc->freelist = r->next;
+    kc->nfree--;
+    buddyfree((char*)r, 0);
+  }
+  unlockpool();
+  kc->drains++;
+}
+
+// Take a page from kc's zeroed pages, or return 0.
+// Caller holds kc->lock.
+static struct run*
+popzero(struct kcache *kc)
+{
+  struct run *r;
+
+  if((r = kc->zerolist) != 0){
+    kc->zerolist = r->next;
+    kc->nzero--;
+    r->next = 0;
+  }
+  return r;
+}
+
+// Take a page from another cpu's cache, or its zeroed pages
+// if zero is set, or return 0 if they are all empty.
+// Caller holds no kcache lock.
+static struct run*
+steal(struct kcache *self, int zero)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  for(kc = kmem.cache; kc < &kmem.cache[NCPU]; kc++){
+    if(kc == self || (zero ? kc->nzero : kc->nfree) == 0)
+      continue;
+    acquire(&kc->lock);
+    if(zero)
+      r = popzero(kc);
+    else if((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      kc->nfree--;
+    }
+    release(&kc->lock);
+    if(r)
+      return r;
+  }
+  return 0;
+}
+
+// Give every cpu's cached and zeroed pages back to the pool,
+// for kalloc_pages().  Caller holds no kcache lock.
+static void
+reclaim(void)
+{
+  struct kcache *kc;
+  struct run *r;
+
+  for(kc = kmem.cache; kc < &kmem.cache[NCPU]; kc++){
+    acquire(&kc->lock);
+    lockpool();
+    while((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      kc->nfree--;
+      buddyfree((char*)r, 0);
+    }
+    while((r = popzero(kc)) != 0)
+      buddyfree((char*)r, 0);
+    unlockpool();
+    release(&kc->lock);
+  }
+}
+
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc(), and free it if it was the last one.
+// (The exception is when initializing the allocator; see
+// kinit above.)
 void
 kfree(char *v)
 {
   struct run *r;
+  struct kcache *kc;
 
-  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
     panic("kfree");
 
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kfree: free page");
+  if(__sync_sub_and_fetch(&kmem.ref[V2P(v)/PGSIZE], 1) > 0)
+    return;
+
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
   r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+  if(!kmem.use_lock){
+    buddyfree(v, 0);
+    return;
+  }
+
+  pushcli();
+  kc = &kmem.cache[cpuid()];
+  acquire(&kc->lock);
+  r->next = kc->freelist;
+  kc->freelist = r;
+  kc->nfree++;
+  if(kc->nfree > 2*KBATCH)
+    drain(kc, KBATCH);
+  release(&kc->lock);
+  popcli();
 }
 
 // Allocate one 4096-byte page of physical memory.
@@ -83,14 +441,209 @@ char*
 kalloc(void)
 {
   struct run *r;
+  struct kcache *kc;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  if(!kmem.use_lock){
+    r = buddyalloc(0);
+  } else {
+    pushcli();
+    kc = &kmem.cache[cpuid()];
+    acquire(&kc->lock);
+    if(kc->freelist)
+      kc->hits++;
+    else
+      refill(kc, KBATCH);
+    if((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      kc->nfree--;
+    }
+    if(r == 0)
+      r = popzero(kc);
+    release(&kc->lock);
+    if(r == 0 && ((r = steal(kc, 0)) != 0 || (r = steal(kc, 1)) != 0))
+      kc->steals++;
+    popcli();
+  }
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+  return (char*)r;
+}
+
+// Allocate one zeroed page, as kalloc() does.  Takes one
+// zeroed while a cpu was idle if there is one.
+char*
+kalloc_zeroed(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  r = 0;
+  if(kmem.use_lock){
+    pushcli();
+    kc = &kmem.cache[cpuid()];
+    acquire(&kc->lock);
+    r = popzero(kc);
+    release(&kc->lock);
+    if(r == 0)
+      r = steal(kc, 1);
+    if(r)
+      kc->zhits++;
+    else
+      kc->zmisses++;
+    popcli();
+  }
+  if(r){
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+    return (char*)r;
+  }
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
   return (char*)r;
 }
 
+// Called by an idle cpu: zero one page from its cache for
+// kalloc_zeroed().  Returns 1 if it did, or 0 if it has
+// enough zeroed pages or no free ones.
+int
+kzeroidle(void)
+{
+  struct run *r;
+  struct kcache *kc;
+
+  if(!kmem.use_lock)
+    return 0;
+  pushcli();
+  kc = &kmem.cache[cpuid()];
+  r = 0;
+  acquire(&kc->lock);
+  if(kc->nzero < KZMAX){
+    if(kc->freelist == 0 && kmem.nfree > kmem.npage/KZLOW)
+      refill(kc, KBATCH);
+    if((r = kc->freelist) != 0){
+      kc->freelist = r->next;
+      kc->nfree--;
+    }
+  }
+  release(&kc->lock);
+  if(r){
+    memset(r, 0, PGSIZE);
+    acquire(&kc->lock);
+    r->next = kc->zerolist;
+    kc->zerolist = r;
+    kc->nzero++;
+    kc->zeroed++;
+    release(&kc->lock);
+  }
+  popcli();
+  return r != 0;
+}
+
+// Allocate 2^order physically contiguous pages, aligned to
+// their size, straight from the pool.  Each page has one
+// reference.  Returns 0 if order is too large or there is no
+// block that big left, even with the cpus' caches reclaimed.
+char*
+kalloc_pages(int order)
+{
+  struct run *r;
+  uint pn, i;
+
+  if(order < 0 || order > MAXORDER)
+    return 0;
+  lockpool();
+  r = buddyalloc(order);
+  unlockpool();
+  if(r == 0 && kmem.use_lock){
+    reclaim();
+    lockpool();
+    kmem.reclaims++;
+    r = buddyalloc(order);
+    unlockpool();
+  }
+  if(r){
+    pn = V2P(r)/PGSIZE;
+    for(i = 0; i < (1 << order); i++)
+      kmem.ref[pn+i] = 1;
+  }
+  return (char*)r;
+}
+
+// Free the block of 2^order pages at v, which must have come
+// from kalloc_pages(order).
+void
+kfree_pages(char *v, int order)
+{
+  uint pn, i;
+
+  if(order < 0 || order > MAXORDER || V2P(v) % (PGSIZE << order) ||
+     v < end || V2P(v) + (PGSIZE << order) > phystop)
+    panic("kfree_pages");
+  pn = V2P(v)/PGSIZE;
+  for(i = 0; i < (1 << order); i++){
+    if(kmem.ref[pn+i] != 1)
+      panic("kfree_pages: shared or free page");
+    kmem.ref[pn+i] = 0;
+  }
+
+#ifdef KDEBUG
+  // Fill with junk to catch dangling refs.
+  memset(v, 1, PGSIZE << order);
+#endif
+
+  lockpool();
+  buddyfree(v, order);
+  unlockpool();
+}
+
+// Add a reference to the allocated page at v.
+void
+kref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= phystop)
+    panic("kref");
+  if(kmem.ref[V2P(v)/PGSIZE] == 0)
+    panic("kref: free page");
+  __sync_add_and_fetch(&kmem.ref[V2P(v)/PGSIZE], 1);
+}
+
+// Number of references to the allocated page at v.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+// Print the free page counts and how each cpu's cache has
+// done, for ps.
+void
+kallocdump(void)
+{
+  struct kcache *kc;
+  int n, k;
+
+  cprintf("CPU\tCached\tHits\tRefills\tDrains\tSteals\tZero\tZeroed\tZHits\tZMisses\n");
+  n = kmem.nfree;
+  for(kc = kmem.cache; kc < &kmem.cache[ncpu]; kc++){
+    cprintf("%d\t%d\t%d\t%d\t%d\t%d\t", kc - kmem.cache, kc->nfree,
+            kc->hits, kc->refills, kc->drains, kc->steals);
+    cprintf("%d\t%d\t%d\t%d\n", kc->nzero, kc->zeroed, kc->zhits, kc->zmisses);
+    n += kc->nfree + kc->nzero;
+  }
+  cprintf("%d free pages, %d in the pool, pool lock contended %d times\n",
+          n, kmem.nfree, kmem.contended);
+
+  // Free memory that is not in the largest free blocks is
+  // fragmented, as far as large allocations are concerned.
+  lockpool();
+  cprintf("Order\tBlocks\tPages\n");
+  for(k = 0; k <= MAXORDER; k++)
+    if(kmem.nblock[k])
+      cprintf("%d\t%d\t%d\n", k, kmem.nblock[k], kmem.nblock[k] << k);
+  for(k = MAXORDER; k > 0 && kmem.nblock[k] == 0; k--)
+    ;
+  cprintf("largest free block order %d, %d%% of the pool in smaller ones, "
+          "%d splits, %d merges, %d reclaims\n", k,
+          kmem.nfree ? 100 - 100*(kmem.nblock[k] << k)/kmem.nfree : 0,
+          kmem.splits, kmem.merges, kmem.reclaims);
+  unlockpool();
+}
@@ -43,6 +43,20 @@
 
 volatile uint *lapic;  // Initialized in mp.c
 
+// Timer interrupts per second, and whether cpus other than
+// the first may stop or slow their timers when they have
+// nothing else to run (see retick in proc.c).
+int hz = HZ;
+#ifdef TICKLESS
+int tickless = 1;
+#else
+int tickless = 0;
+#endif
+
+// The timer counts down at bus frequency, which xv6 does not
+// measure; this many counts is taken to be a hundredth of a second.
+#define TICR100 10000000
+
 //PAGEBREAK!
 static void
 lapicw(int index, int value)
@@ -65,8 +79,7 @@ lapicinit(void)
   // If xv6 cared more about precise timekeeping,
   // TICR would be calibrated using an external time source.
   lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicperiodic();
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -97,6 +110,31 @@ lapicinit(void)
   lapicw(TPR, 0);
 }
 
+// Interrupt hz times a second.
+void
+lapicperiodic(void)
+{
+  if(!lapic)
+    return;
+  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  lapicw(TICR, TICR100 * 100 / hz);
+}
+
+// Interrupt once, n ticks from now, or never if n is 0.
+void
+lapiconeshot(uint n)
+{
+  uint count;
+
+  if(!lapic)
+    return;
+  count = TICR100 * 100 / hz;
+  if(n > 0xFFFFFFFF / count)
+    n = 0xFFFFFFFF / count;
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, count * n);
+}
+
 int
 lapicid(void)
 {
@@ -113,6 +151,20 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send a fixed interrupt with the given vector to the cpu
+// with local APIC id apicid.  Interrupts must be disabled,
+// so nothing else uses the ICR in between the two writes.
+void
+lapicipi(int apicid, int vector)
+{
+  if(!lapic)
+    return;
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | ASSERT | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -1,7 +1,10 @@
 // Memory layout
 
 #define EXTMEM  0x100000            // Start of extended memory
-#define PHYSTOP 0xE000000           // Top physical memory
+#define PHYSTOP 0x40000000          // Most physical memory the kernel can use
+#define PHYSDEF 0xE000000           // Top physical memory if there is no map
+#define E820MAP 0x8000              // Where bootasm.S leaves the BIOS memory map
+#define E820MAX 32                  // Most entries it takes
 #define DEVSPACE 0xFE000000         // Other devices are at high addresses
 
 // Key addresses for address space layout (see kmap in vm.c for layout)
@@ -1,14 +1,22 @@
-#define NPROC        64  // maximum number of processes
+#ifndef NPROC
+#define NPROC      4096  // default limit on the number of processes
+#endif
 #define KSTACKSIZE 4096  // size of per-process kernel stack
+#define MAXORDER     10  // largest kalloc_pages() block is 2^MAXORDER pages
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
 #define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define NBUF         (MAXOPBLOCKS*3)  // buffers the disk block cache keeps when idle
+#define NINODE       50  // unused i-nodes the inode cache keeps
+#define FSSIZE       2000  // size of file system in blocks
+#ifndef HZ
+#define HZ          100  // default timer ticks per second
+#endif
+#ifndef QUANTUM
+#define QUANTUM       1  // default scheduling time slice, in ticks
+#endif
 
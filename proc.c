@@ -4,37 +4,92 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "x86.h"
-#include "proc.h"
+#include "traps.h"
 #include "spinlock.h"
+#include "proc.h"
 #define AGE_CUTOFF 200
-
+#define BALANCE_INTERVAL 4  // ticks between periodic load balancing
+#define NSLEEPQ 64          // buckets in the wait channel hash table
+#define NPIDHASH 512        // buckets in the pid hash table
+#define DEFTICKETS 100      // stride scheduling share of a new process
+#define MAXTICKETS 10000
+#define RTMAXUTIL 950       // per mille of a cpu real-time processes may reserve
+
+// ptable.lock guards the list of processes, their allocation,
+// and the parent/child relationships (p->parent and the
+// children lists), and is the lock wait() sleeps on.
+// Everything the scheduler looks at is protected by the
+// per-process p->lock and the per-cpu run queue locks.
+//
+// struct procs are carved out of whole pages as they are
+// needed, and go on a free list when a process is reaped.
+// The pages are never given back, so a struct proc stays one
+// (with an initialized p->lock) even while it is free; a
+// stale pointer finds it UNUSED rather than reused memory.
 struct {
   struct spinlock lock;
-  struct proc proc[NPROC];
+  struct proc *list;           // Processes in use, newest first
+  struct proc *free;           // Carved out but UNUSED
+  int nproc;                   // Number on list
+  int npages;                  // Pages carved up for procs
 } ptable;
 
+int maxproc = NPROC;           // Soft limit on the number of processes
+
+// Sleeping processes are linked into the bucket their
+// channel hashes to, so wakeup() only looks at those.
+// Lock order: a bucket lock, then p->lock.
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+} sleepq[NSLEEPQ];
+
+// Processes in the real-time class, and the share of each
+// cpu they reserve, are protected by rtlock.
+// Lock order: ptable.lock, then rtlock, then p->lock.
+struct spinlock rtlock;
+struct proc *rtlist;
+
+// Processes hashed by pid, so they can be found without
+// looking through the table.  pidlock is taken last; see findproc.
+struct spinlock pidlock;
+struct proc *pidhash[NPIDHASH];
+
+// Threads sharing an address space are linked in a ring
+// through vmnext, so its users and size are found without
+// looking through the table.  vmlock protects the rings and
+// the threads' sz.  Lock order: ptable.lock, p->lock, vmlock.
+struct spinlock vmlock;
+
 static struct proc *initproc;
 
 #ifdef MLFQ
-  struct procQueue proc_queue[5];
+  struct procQueue proc_queue[NQUEUE];
 #endif
 
 int nextpid = 1;
+int quantum = QUANTUM;  // ticks a process runs before the next gets a turn
 extern void forkret(void);
 extern void trapret(void);
 
-static void wakeup1(void *chan);
-
 void
 pinit(void)
 {
+  struct cpu *c;
+  int i;
+
   initlock(&ptable.lock, "ptable");
+  initlock(&rtlock, "rt");
+  initlock(&pidlock, "pid");
+  initlock(&vmlock, "vm");
+  for(c = cpus; c < &cpus[NCPU]; c++)
+    initlock(&c->rq.lock, "runq");
+  for(i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
 
   #ifdef MLFQ
-    int i;
-    for(i=0; i<5; i++){
-      proc_queue[i].timeslice_cutoff = (1 << i);
-      proc_queue[i].largest_position = 0;
+    for(i=0; i<NQUEUE; i++){
+      proc_queue[i].timeslice_cutoff = (quantum << i);
     }
   #endif
 }
@@ -78,36 +133,1064 @@ myproc(void) {
   return p;
 }
 
-//PAGEBREAK: 32
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and initialize
-// state required to run in the kernel.
-// Otherwise return 0.
+// The sleep queue for chan.  Multiplying by a large odd
+// constant spreads nearby addresses (e.g. the nread and
+// nwrite fields of a pipe) over different buckets.
+static struct sleepq*
+chanq(void *chan)
+{
+  return &sleepq[(((uint)chan * 2654435761U) >> 16) % NSLEEPQ];
+}
+
+//PAGEBREAK: 30
+// Run queues.  Each cpu keeps its RUNNABLE processes in
+// doubly-linked lists, one per level, ordered by the scheduling
+// policy, so that picking the next process is just taking the
+// head of the first non-empty level.
+
+// Is p in the real-time class, with runtime left this period?
+static int
+isrt(struct proc *p)
+{
+  return p->rtperiod && p->rtleft > 0;
+}
+
+// Return non-zero if a should run before b.
+// Only called for processes on the same level l.
+static int
+rqbefore(struct proc *a, struct proc *b, int l)
+{
+  if(l == RTLEVEL)
+    return (int)(a->rtdl - b->rtdl) < 0;  // earliest deadline first
+#ifdef FCFS
+  return a->ctime < b->ctime;
+#endif
+#ifdef PBS
+  return a->priority < b->priority;
+#endif
+#ifdef STRIDE
+  return (int)(a->pass - b->pass) < 0;
+#endif
+#ifdef MLFQ
+  // longest waiting first, so age() need only look at heads;
+  // a process that just ran goes behind the others, as in FIFO
+  return (int)(a->wstart - b->wstart) < 0;
+#endif
+  return 0;  // round robin: plain FIFO
+}
+
+#ifdef CFS
+// Completely fair scheduling.  Each process accumulates
+// virtual run time at a rate inversely proportional to its
+// weight, and the one with the least runs next.  Its slice
+// is its share of CFS_LATENCY, so that every process queued
+// runs once in about that long, but no less than CFS_MINGRAN.
+#define CFS_LATENCY 6     // ticks
+#define CFS_MINGRAN 1     // ticks
+#define NICE_0_LOAD 1024  // weight of the default priority, 60
+
+// Weights for nice values -20..19, each about 1.25 times
+// the next, as in Linux; a step is worth 10% of the cpu.
+static uint prio2weight[40] = {
+  88761, 71755, 56483, 46273, 36291,
+  29154, 23254, 18705, 14949, 11916,
+   9548,  7620,  6100,  4904,  3906,
+   3121,  2501,  1991,  1586,  1277,
+   1024,   820,   655,   526,   423,
+    335,   272,   215,   172,   137,
+    110,    87,    70,    56,    45,
+     36,    29,    23,    18,    15,
+};
+
+// Map set_priority()'s 0..100, default 60, onto nice -20..19.
+static uint
+weight(struct proc *p)
+{
+  int nice;
+
+  if(p->priority <= 60)
+    nice = (p->priority - 60) / 3;
+  else
+    nice = (p->priority - 60) * 19 / 40;
+  return prio2weight[nice + 20];
+}
+
+// Virtual time charged to p for one tick of running.
+static uint
+vdelta(struct proc *p)
+{
+  return (NICE_0_LOAD << 10) / p->weight;
+}
+
+// Virtual times wrap around; compare them by difference.
+static int
+vbefore(uint a, uint b)
+{
+  return (int)(a - b) < 0;
+}
+
+// Red-black tree of the processes on a run queue, keyed by
+// vruntime.  Equal keys go to the right, so ties run FIFO.
+// Caller must hold rq->lock.
+static void
+rbrotate(struct runq *rq, struct proc *x, int left)
+{
+  struct proc *y;
+
+  if(left){
+    y = x->rbright;
+    x->rbright = y->rbleft;
+    if(y->rbleft)
+      y->rbleft->rbparent = x;
+    y->rbleft = x;
+  } else {
+    y = x->rbleft;
+    x->rbleft = y->rbright;
+    if(y->rbright)
+      y->rbright->rbparent = x;
+    y->rbright = x;
+  }
+  y->rbparent = x->rbparent;
+  if(x->rbparent == 0)
+    rq->root = y;
+  else if(x == x->rbparent->rbleft)
+    x->rbparent->rbleft = y;
+  else
+    x->rbparent->rbright = y;
+  x->rbparent = y;
+}
+
+static void
+rbinsert(struct runq *rq, struct proc *p)
+{
+  struct proc *q, *parent, *g, *u;
+  int leftmost;
+
+  parent = 0;
+  leftmost = 1;
+  for(q = rq->root; q; ){
+    parent = q;
+    if(vbefore(p->vruntime, q->vruntime))
+      q = q->rbleft;
+    else {
+      q = q->rbright;
+      leftmost = 0;
+    }
+  }
+  p->rbparent = parent;
+  p->rbleft = p->rbright = 0;
+  p->rbred = 1;
+  if(parent == 0)
+    rq->root = p;
+  else if(vbefore(p->vruntime, parent->vruntime))
+    parent->rbleft = p;
+  else
+    parent->rbright = p;
+  if(leftmost)
+    rq->leftmost = p;
+
+  // Restore the red-black properties.
+  while((parent = p->rbparent) != 0 && parent->rbred){
+    g = parent->rbparent;
+    u = parent == g->rbleft ? g->rbright : g->rbleft;
+    if(u && u->rbred){
+      parent->rbred = u->rbred = 0;
+      g->rbred = 1;
+      p = g;
+      continue;
+    }
+    if(parent == g->rbleft){
+      if(p == parent->rbright){
+        rbrotate(rq, parent, 1);
+        parent = p;
+      }
+      rbrotate(rq, g, 0);
+    } else {
+      if(p == parent->rbleft){
+        rbrotate(rq, parent, 0);
+        parent = p;
+      }
+      rbrotate(rq, g, 1);
+    }
+    parent->rbred = 0;
+    g->rbred = 1;
+    break;
+  }
+  rq->root->rbred = 0;
+}
+
+// In-order successor of p, or 0.
 static struct proc*
-allocproc(void)
+rbnext(struct proc *p)
+{
+  struct proc *q;
+
+  if(p->rbright){
+    for(p = p->rbright; p->rbleft; p = p->rbleft)
+      ;
+    return p;
+  }
+  while((q = p->rbparent) != 0 && p == q->rbright)
+    p = q;
+  return q;
+}
+
+static void
+rberase(struct runq *rq, struct proc *p)
+{
+  struct proc *y, *x, *parent, *w;
+  int red;
+
+  if(rq->leftmost == p)
+    rq->leftmost = rbnext(p);
+
+  // Unlink y, which is p or, if p has two children,
+  // p's successor, which then takes p's place.
+  y = (p->rbleft && p->rbright) ? rbnext(p) : p;
+  x = y->rbleft ? y->rbleft : y->rbright;
+  parent = y->rbparent;
+  if(x)
+    x->rbparent = parent;
+  if(parent == 0)
+    rq->root = x;
+  else if(y == parent->rbleft)
+    parent->rbleft = x;
+  else
+    parent->rbright = x;
+  red = y->rbred;
+  if(y != p){
+    if(parent == p)
+      parent = y;
+    y->rbparent = p->rbparent;
+    y->rbleft = p->rbleft;
+    y->rbright = p->rbright;
+    y->rbred = p->rbred;
+    if(p->rbparent == 0)
+      rq->root = y;
+    else if(p == p->rbparent->rbleft)
+      p->rbparent->rbleft = y;
+    else
+      p->rbparent->rbright = y;
+    if(y->rbleft)
+      y->rbleft->rbparent = y;
+    if(y->rbright)
+      y->rbright->rbparent = y;
+  }
+  p->rbparent = p->rbleft = p->rbright = 0;
+  if(red)
+    return;
+
+  // A black node went away: x is short one black.
+  while(x != rq->root && (x == 0 || !x->rbred)){
+    if(x == parent->rbleft){
+      w = parent->rbright;
+      if(w->rbred){
+        w->rbred = 0;
+        parent->rbred = 1;
+        rbrotate(rq, parent, 1);
+        w = parent->rbright;
+      }
+      if((w->rbleft == 0 || !w->rbleft->rbred) &&
+         (w->rbright == 0 || !w->rbright->rbred)){
+        w->rbred = 1;
+        x = parent;
+        parent = x->rbparent;
+        continue;
+      }
+      if(w->rbright == 0 || !w->rbright->rbred){
+        w->rbleft->rbred = 0;
+        w->rbred = 1;
+        rbrotate(rq, w, 0);
+        w = parent->rbright;
+      }
+      w->rbred = parent->rbred;
+      parent->rbred = 0;
+      if(w->rbright)
+        w->rbright->rbred = 0;
+      rbrotate(rq, parent, 1);
+    } else {
+      w = parent->rbleft;
+      if(w->rbred){
+        w->rbred = 0;
+        parent->rbred = 1;
+        rbrotate(rq, parent, 0);
+        w = parent->rbleft;
+      }
+      if((w->rbleft == 0 || !w->rbleft->rbred) &&
+         (w->rbright == 0 || !w->rbright->rbred)){
+        w->rbred = 1;
+        x = parent;
+        parent = x->rbparent;
+        continue;
+      }
+      if(w->rbleft == 0 || !w->rbleft->rbred){
+        w->rbright->rbred = 0;
+        w->rbred = 1;
+        rbrotate(rq, w, 1);
+        w = parent->rbleft;
+      }
+      w->rbred = parent->rbred;
+      parent->rbred = 0;
+      if(w->rbleft)
+        w->rbleft->rbred = 0;
+      rbrotate(rq, parent, 0);
+    }
+    x = rq->root;
+  }
+  if(x)
+    x->rbred = 0;
+}
+
+// Advance c's minvrun to the smallest vruntime on c, counting
+// p, the process running there, if any.  Caller must hold c->rq.lock.
+static void
+updminvrun(struct cpu *c, struct proc *p)
+{
+  struct runq *rq = &c->rq;
+  uint v;
+
+  if(p)
+    v = p->vruntime;
+  else if(rq->leftmost)
+    v = rq->leftmost->vruntime;
+  else
+    return;
+  if(p && rq->leftmost && vbefore(rq->leftmost->vruntime, v))
+    v = rq->leftmost->vruntime;
+  if(vbefore(rq->minvrun, v))
+    rq->minvrun = v;
+}
+#endif
+
+#ifdef STRIDE
+// Stride scheduling.  Each tick run advances a process's pass
+// by STRIDE1 / tickets, and the one with the smallest pass runs
+// next, so processes get the cpu in proportion to their tickets.
+#define STRIDE1 (1 << 20)
+#endif
+
+// p is moving from one cpu's run queue to another's.  Rebase
+// the policy's clock value of p onto the new cpu, so that it
+// keeps its lead or lag behind the processes there.
+static void
+rqmove(struct proc *p, struct cpu *from, struct cpu *to)
+{
+#ifdef CFS
+  p->vruntime += to->rq.minvrun - from->rq.minvrun;
+#endif
+#ifdef STRIDE
+  p->pass += to->rq.minpass - from->rq.minpass;
+#endif
+}
+
+// Set the clock value of p, about to be queued on c.
+// A new process starts level with the others there.
+static void
+rqplace(struct proc *p, struct cpu *c, int waking)
+{
+#ifdef CFS
+  uint floor;
+
+  if(p->lastcpu == 0){
+    p->vruntime = c->rq.minvrun;
+    return;
+  }
+  if(p->lastcpu != c)
+    rqmove(p, p->lastcpu, c);
+  // One waking up keeps at most half a latency of credit for
+  // the time it slept: it runs soon but cannot hog the cpu.
+  floor = c->rq.minvrun - CFS_LATENCY * NICE_0_LOAD / 2;
+  if(waking && vbefore(p->vruntime, floor))
+    p->vruntime = floor;
+#endif
+#ifdef STRIDE
+  if(p->lastcpu && p->lastcpu != c)
+    rqmove(p, p->lastcpu, c);
+  // Time spent asleep earns no credit.
+  if(p->lastcpu == 0 || (int)(p->pass - c->rq.minpass) < 0)
+    p->pass = c->rq.minpass;
+#endif
+}
+
+// Link p into rq's list for level l, behind every process
+// that should run before it.  Caller must hold rq->lock.
+static void
+rqlink(struct runq *rq, struct proc *p, int l)
+{
+  struct proc *q;
+
+  for(q = rq->tail[l]; q && rqbefore(p, q, l); q = q->rqprev)
+    ;
+  p->rqprev = q;
+  if(q){
+    p->rqnext = q->rqnext;
+    q->rqnext = p;
+  } else {
+    p->rqnext = rq->head[l];
+    rq->head[l] = p;
+  }
+  if(p->rqnext)
+    p->rqnext->rqprev = p;
+  else
+    rq->tail[l] = p;
+}
+
+// Put p on c's run queue at level l.
+// Caller must hold c->rq.lock.
+static void
+rqinsert(struct cpu *c, struct proc *p, int l)
+{
+  struct runq *rq = &c->rq;
+
+#ifdef CFS
+  if(l != RTLEVEL){
+    p->weight = weight(p);
+    rbinsert(rq, p);
+    rq->load += p->weight;
+  } else
+#endif
+    rqlink(rq, p, l);
+  p->rqcpu = c;
+  p->rqlevel = l;
+  rq->nonempty |= 1 << l;
+  rq->nready++;
+}
+
+// Put p on c's run queue.  Caller must hold p->lock.
+static void
+rqadd(struct cpu *c, struct proc *p)
+{
+  int l;
+
+  l = 0;
+  #ifdef MLFQ
+    l = p->cur_q;
+  #endif
+  if(isrt(p))
+    l = RTLEVEL;
+
+  acquire(&c->rq.lock);
+  rqinsert(c, p, l);
+  release(&c->rq.lock);
+}
+
+// Unlink p from rq.  Caller must hold rq->lock.
+static void
+rqunlink(struct runq *rq, struct proc *p)
+{
+  int l = p->rqlevel;
+
+#ifdef CFS
+  if(l != RTLEVEL){
+    rberase(rq, p);
+    rq->load -= p->weight;
+    if(rq->root == 0)
+      rq->nonempty &= ~(1 << l);
+    p->rqcpu = 0;
+    rq->nready--;
+    return;
+  }
+#endif
+  if(p->rqprev)
+    p->rqprev->rqnext = p->rqnext;
+  else
+    rq->head[l] = p->rqnext;
+  if(p->rqnext)
+    p->rqnext->rqprev = p->rqprev;
+  else
+    rq->tail[l] = p->rqprev;
+  if(rq->head[l] == 0)
+    rq->nonempty &= ~(1 << l);
+  p->rqnext = p->rqprev = 0;
+  p->rqcpu = 0;
+  rq->nready--;
+}
+
+// Take p off whatever run queue it is on.
+// Returns the cpu it was queued on, or 0 if a
+// scheduler has already taken it.
+// Caller must hold p->lock.
+static struct cpu*
+rqdel(struct proc *p)
+{
+  struct cpu *c;
+
+  while((c = p->rqcpu) != 0){
+    acquire(&c->rq.lock);
+    if(p->rqcpu == c){
+      rqunlink(&c->rq, p);
+      release(&c->rq.lock);
+      return c;
+    }
+    release(&c->rq.lock);
+  }
+  return 0;
+}
+
+// Re-sort p on its run queue after its priority
+// or queue changed.  Caller must hold p->lock.
+static void
+rqupdate(struct proc *p)
+{
+  struct cpu *c;
+
+  if((c = rqdel(p)) != 0)
+    rqadd(c, p);
+}
+
+// May p run on cpu c?
+static int
+allowed(struct proc *p, struct cpu *c)
+{
+  return (p->cpumask >> (c - cpus)) & 1;
+}
+
+// Remove and return the process at the head of rq, or 0.
+// If to is set, the process is being moved to that cpu: real-
+// time processes, which stay on the cpu they were admitted on,
+// and those whose affinity does not include it are passed over.
+// Caller must hold rq->lock.
+static struct proc*
+rqhead(struct runq *rq, struct cpu *to)
 {
   struct proc *p;
-  char *sp;
+#ifndef CFS
+  uint levels;
+  int l;
+#endif
 
-  acquire(&ptable.lock);
+  p = 0;
+  if(to == 0 && (rq->nonempty & (1 << RTLEVEL)))
+    p = rq->head[RTLEVEL];
+  else {
+#ifdef CFS
+    for(p = rq->leftmost; p && to && !allowed(p, to); p = rbnext(p))
+      ;
+#else
+    levels = rq->nonempty & ~(1 << RTLEVEL);
+    for(; levels && p == 0; levels &= ~(1 << l)){
+      l = bsf(levels);
+      for(p = rq->head[l]; p && to && !allowed(p, to); p = p->rqnext)
+        ;
+    }
+#endif
+  }
+  if(p == 0)
+    return 0;
+  rqunlink(rq, p);
+  return p;
+}
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == UNUSED)
-      goto found;
+// Remove and return the next process to run on c, or 0.
+static struct proc*
+rqpick(struct cpu *c)
+{
+  struct proc *p;
 
-  release(&ptable.lock);
+  acquire(&c->rq.lock);
+  p = rqhead(&c->rq, 0);
+  release(&c->rq.lock);
+  return p;
+}
+
+// The cpu other than c with the most processes queued.
+// The queue lengths are read without locks, so this is
+// only a hint; callers recheck under the run queue lock.
+static struct cpu*
+busiest(struct cpu *c)
+{
+  struct cpu *b, *best;
+
+  best = 0;
+  for(b = cpus; b < cpus+ncpu; b++)
+    if(b != c && (best == 0 || b->rq.nready > best->rq.nready))
+      best = b;
+  return best;
+}
+
+// Called by an idle cpu c: take the next process waiting
+// on the busiest other cpu, to be run by c right away.
+static struct proc*
+rqsteal(struct cpu *c)
+{
+  struct cpu *b;
+  struct proc *p;
+
+  if((b = busiest(c)) == 0 || b->rq.nready == 0)
+    return 0;
+  acquire(&b->rq.lock);
+  p = rqhead(&b->rq, c);
+  release(&b->rq.lock);
+  if(p){
+    rqmove(p, b, c);
+    c->rq.nsteal++;
+  }
+  return p;
+}
+
+// Periodic load balancing, called from c's timer interrupt.
+// If some cpu has at least two more processes waiting than
+// c, pull over the one that has waited longest there; its
+// cache on that cpu is the coldest.
+static void
+balance(struct cpu *c)
+{
+  struct cpu *b;
+  struct proc *p;
+
+  if(ticks % BALANCE_INTERVAL)
+    return;
+  if((b = busiest(c)) == 0 || b->rq.nready - c->rq.nready < 2)
+    return;
+
+  // Lock the two queues in a fixed order to avoid deadlock.
+  if(b < c){
+    acquire(&b->rq.lock);
+    acquire(&c->rq.lock);
+  } else {
+    acquire(&c->rq.lock);
+    acquire(&b->rq.lock);
+  }
+  if(b->rq.nready - c->rq.nready >= 2 && (p = rqhead(&b->rq, c)) != 0){
+    rqmove(p, b, c);
+    rqinsert(c, p, p->rqlevel);
+    c->rq.nmigrate++;
+  }
+  release(&b->rq.lock);
+  release(&c->rq.lock);
+}
+
+// Choose the cpu that should run p next.  A process that has
+// run before goes back to its last cpu, whose cache is warm,
+// unless that cpu is busy and another one is idle.
+// A new process goes to the cpu with the shortest queue.
+// Only cpus in p's affinity mask are considered, and a real-
+// time process always goes to the cpu it was admitted on.
+static struct cpu*
+rqchoose(struct proc *p)
+{
+  struct cpu *c, *best, *last;
+
+  if(p->rtperiod)
+    return p->rtcpu;
+  last = p->lastcpu;
+  if(last && !allowed(p, last))
+    last = 0;
+  if(last && last->proc == 0)
+    return last;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(allowed(p, c) && c->proc == 0 && c->rq.nready == 0)
+      return c;
+  if(last)
+    return last;
+  best = 0;
+  for(c = cpus; c < cpus+ncpu; c++)
+    if(allowed(p, c) && (best == 0 || c->rq.nready < best->rq.nready))
+      best = c;
+  return best;
+}
+
+// Account the ticks since c last did to it being busy or idle.
+// Must be called with interrupts disabled, before c->proc changes.
+static void
+cputime(struct cpu *c)
+{
+  uint n;
+
+  n = ticks - c->lasttick;
+  c->lasttick = ticks;
+  c->nticks += n;
+  if(c->proc == 0)
+    c->idleticks += n;
+}
+
+// Program c's timer, which must be this cpu's, for what it is
+// doing now.  In tickless mode a cpu with nothing queued does
+// not need interrupting to switch processes, so when idle it
+// stops its timer and when running one process it only looks
+// again after a second.  The first cpu keeps ticking, as it
+// keeps time, and so does one with real-time processes.
+// Interrupts must be disabled.
+static void
+retick(struct cpu *c)
+{
+  if(tickless && c != cpus && c->rq.nready == 0 && c->rq.rtutil == 0){
+    lapiconeshot(c->proc ? hz : 0);
+    c->tickstopped = 1;
+  } else if(c->tickstopped || c->hz != hz){
+    lapicperiodic();
+    c->tickstopped = 0;
+  }
+  c->hz = hz;
+}
+
+// Return non-zero if p should take the cpu away from cur.
+static int
+preempts(struct proc *p, struct proc *cur)
+{
+  if(isrt(p))
+    return !isrt(cur) || (int)(p->rtdl - cur->rtdl) < 0;
+  if(isrt(cur))
+    return 0;
+#ifdef PBS
+  return p->priority < cur->priority;
+#endif
+#ifdef MLFQ
+  return p->cur_q < cur->cur_q;
+#endif
+#ifdef CFS
+  // only if p is behind by more than a tick, to avoid
+  // switching back and forth between near equals
+  return (int)(cur->vruntime - p->vruntime) > NICE_0_LOAD;
+#endif
   return 0;
+}
+
+// Make c give up the process it is running, with a
+// reschedule interrupt; see reschedintr.
+static void
+preempt(struct cpu *c)
+{
+  c->resched = 1;
+  lapicipi(c->apicid, T_RESCHED);
+}
+
+// p was just queued on c.  Send c a reschedule interrupt if
+// it is idle (and so may be halted), or is running something
+// p should preempt.  c->proc is read without a lock; at worst
+// that costs a spurious interrupt or a wait for the next tick.
+static void
+kick(struct cpu *c, struct proc *p)
+{
+  struct proc *cur = c->proc;
+
+  if(cur == 0){
+    if(c != mycpu())
+      lapicipi(c->apicid, T_RESCHED);
+  } else if(preempts(p, cur))
+    preempt(c);
+  else if(c->tickstopped){
+    // c would not look at its queue for a while
+    if(c == mycpu())
+      retick(c);
+    else
+      lapicipi(c->apicid, T_RESCHED);
+  }
+}
+
+// Handle a reschedule interrupt (see kick): restart the timer
+// if it was stopped, and return whether the running process
+// should give the cpu up to one queued to preempt it.
+// Interrupts must be disabled.
+int
+reschedintr(void)
+{
+  struct cpu *c = mycpu();
+  int r;
 
-found:
+  retick(c);
+  r = c->resched;
+  c->resched = 0;
+  return r;
+}
+
+// If p is waiting to run, choose its cpu and place in the
+// queue again, after its class or affinity changed.
+// Caller must hold p->lock.
+static void
+requeue(struct proc *p)
+{
+  struct cpu *c;
+
+  if(rqdel(p) != 0){
+    c = rqchoose(p);
+    rqadd(c, p);
+    kick(c, p);
+  }
+}
+
+//PAGEBREAK: 30
+// Real-time class.  A process declares that it needs runtime
+// ticks of cpu in every period, by deadline ticks into it.
+// Admission reserves runtime/deadline of one cpu for it, and
+// rejects it if no cpu has that much left.  Until it has had
+// its runtime for the period, it waits on that cpu's RTLEVEL
+// queue, and the one with the earliest deadline runs before
+// any other process.  After that it is an ordinary process
+// until the next period starts.
+
+// Start the new periods of the real-time processes on c
+// that are due.  A process still waiting for runtime when
+// its period ends has missed its deadline.
+static void
+rtperiods(struct cpu *c)
+{
+  struct proc *p;
+
+  if(rtlist == 0)
+    return;
+  acquire(&rtlock);
+  for(p = rtlist; p; p = p->rtnext){
+    if(p->rtcpu != c || (int)(ticks - p->rtrelease) < 0)
+      continue;
+    acquire(&p->lock);
+    if(p->rtleft > 0 && (p->state == RUNNABLE || p->state == RUNNING))
+      p->rtmisses++;
+    while((int)(ticks - p->rtrelease) >= 0)
+      p->rtrelease += p->rtperiod;
+    p->rtdl = p->rtrelease - p->rtperiod + p->rtdeadline;
+    p->rtleft = p->rtruntime;
+    // a running one may have been queued as an ordinary
+    // process; it goes back through the real-time queue
+    if(p->state == RUNNING)
+      preempt(p->lastcpu);
+    else
+      requeue(p);
+    release(&p->lock);
+  }
+  release(&rtlock);
+}
+
+// Take p out of the real-time class.
+// Caller must hold rtlock and p->lock.
+static void
+rtleave(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &rtlist; *pp != p; pp = &(*pp)->rtnext)
+    ;
+  *pp = p->rtnext;
+  p->rtcpu->rq.rtutil -= p->rtutil;
+  p->rtperiod = 0;
+  p->rtleft = 0;
+  requeue(p);
+}
+
+#ifdef MLFQ
+// Aging: move p up one queue after waiting AGE_CUTOFF ticks
+// without running, and start counting its wait again.
+static void
+promote(struct proc *p)
+{
+  p->cur_q--;
+  p->wstart += AGE_CUTOFF + 1;
+
+  #ifdef BONUS
+    // for bonus part, stamped with the tick the promotion was
+    // due, which is earlier than now when catching up
+    cprintf("%d,%d,%d,Aging\n", p->pid, p->cur_q, p->wstart);
+    // cprintf("-> [%d] %d %d (Aging)\n", p->pid, p->cur_q, ticks);
+  #endif
+}
+
+// Age the processes waiting on c's queues.  Each queue is in
+// wstart order (see rqbefore), so the ones that have waited
+// long enough are at its head.
+static void
+age(struct cpu *c)
+{
+  struct proc *p;
+  int l;
+
+  acquire(&c->rq.lock);
+  for(l = 1; l < NQUEUE; l++){
+    while((p = c->rq.head[l]) != 0 && ticks - p->wstart > AGE_CUTOFF){
+      // moved up to the higher queue, in its wstart order
+      rqunlink(&c->rq, p);
+      promote(p);
+      rqinsert(c, p, p->cur_q);
+    }
+  }
+  release(&c->rq.lock);
+}
+#endif
+
+// Mark p RUNNABLE and queue it on a cpu.
+// Caller must hold p->lock.
+static void
+setrunnable(struct proc *p)
+{
+  struct cpu *c;
+
+  #ifdef MLFQ
+    // catch up on aging for time spent asleep
+    while(p->cur_q > 0 && ticks - p->wstart > AGE_CUTOFF)
+      promote(p);
+  #endif
+
+  c = rqchoose(p);
+  rqplace(p, c, p->state == SLEEPING);
+  p->state = RUNNABLE;
+  rqadd(c, p);
+  kick(c, p);
+}
+
+//PAGEBREAK: 22
+// The pid hash table and the children lists.
+
+static void
+pidinsert(struct proc *p)
+{
+  struct proc **pp = &pidhash[(uint)p->pid % NPIDHASH];
+
+  acquire(&pidlock);
+  p->pidnext = *pp;
+  *pp = p;
+  release(&pidlock);
+}
+
+static void
+pidremove(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pidlock);
+  for(pp = &pidhash[(uint)p->pid % NPIDHASH]; *pp; pp = &(*pp)->pidnext){
+    if(*pp == p){
+      *pp = p->pidnext;
+      break;
+    }
+  }
+  release(&pidlock);
+}
+
+// Find the live process with the given pid, and return it
+// with p->lock held, or 0 if there is none.  pidlock is let go
+// before p->lock is taken, as freeproc takes them the other
+// way round; p is checked again once it is locked.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquire(&pidlock);
+  for(p = pidhash[(uint)pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&pidlock);
+  if(p == 0)
+    return 0;
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == UNUSED){
+    release(&p->lock);
+    return 0;
+  }
+  return p;
+}
+
+// Make p a child of parent.  Caller must hold ptable.lock.
+static void
+addchild(struct proc *parent, struct proc *p)
+{
+  p->parent = parent;
+  p->sibprev = 0;
+  p->sibnext = parent->children;
+  if(parent->children)
+    parent->children->sibprev = p;
+  parent->children = p;
+}
+
+// Take p off its parent's children.  Caller must hold ptable.lock.
+static void
+delchild(struct proc *p)
+{
+  if(p->sibprev)
+    p->sibprev->sibnext = p->sibnext;
+  else
+    p->parent->children = p->sibnext;
+  if(p->sibnext)
+    p->sibnext->sibprev = p->sibprev;
+  p->parent = 0;
+}
+
+// Take an UNUSED proc off the free list, carving up
+// another page if it is empty, and put it on the list of
+// processes.  Returns 0 at the limit or out of memory.
+// Caller must hold ptable.lock.
+static struct proc*
+procget(void)
+{
+  struct proc *p;
+  char *page;
+  int i;
+
+  if(ptable.nproc >= maxproc)
+    return 0;
+  if(ptable.free == 0){
+    if((page = kalloc_zeroed()) == 0)
+      return 0;
+    for(i = 0; i < PGSIZE / sizeof(struct proc); i++){
+      p = (struct proc*)page + i;
+      initlock(&p->lock, "proc");
+      p->next = ptable.free;
+      ptable.free = p;
+    }
+    ptable.npages++;
+  }
+  p = ptable.free;
+  ptable.free = p->next;
+
+  p->prev = 0;
+  p->next = ptable.list;
+  if(ptable.list)
+    ptable.list->prev = p;
+  ptable.list = p;
+  ptable.nproc++;
+  return p;
+}
+
+// Take p off the list of processes and free it.
+// Caller must hold ptable.lock.
+static void
+procput(struct proc *p)
+{
+  if(p->prev)
+    p->prev->next = p->next;
+  else
+    ptable.list = p->next;
+  if(p->next)
+    p->next->prev = p->prev;
+  ptable.nproc--;
+
+  p->prev = 0;
+  p->next = ptable.free;
+  ptable.free = p;
+}
+
+//PAGEBREAK: 32
+// Allocate a proc, change its state to EMBRYO and
+// initialize state required to run in the kernel.
+// Return 0 if there are too many processes or no memory.
+static struct proc*
+allocproc(void)
+{
+  struct proc *p;
+  char *sp;
+
+  acquire(&ptable.lock);
+  if((p = procget()) == 0){
+    release(&ptable.lock);
+    return 0;
+  }
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->pgdir = 0;
+  p->vmnext = p->vmprev = p;
+  p->isthread = 0;
+  p->children = 0;
+  pidinsert(p);
   //cprintf("->%d\n", ticks);
 
   release(&ptable.lock);
 
   // Allocate kernel stack.
   if((p->kstack = kalloc()) == 0){
+    acquire(&ptable.lock);
+    pidremove(p);
     p->state = UNUSED;
+    procput(p);
+    release(&ptable.lock);
     return 0;
   }
   sp = p->kstack + KSTACKSIZE;
@@ -130,17 +1213,27 @@ found:
   p->ctime = ticks;
   p->etime = p->ctime;
   p->rtime = 0;
-  p->tmp_wtime = 0;
+  p->wstart = p->ctime;
   p->priority = 60;
   p->n_run = 0;
 
   p->timeslice = 0;
-  p->position_priority = 0;
 
   // flags
-  p->io = 0;
   p->tickflag = -1;
 
+  // not yet queued on any cpu
+  p->rqcpu = 0;
+  p->lastcpu = 0;
+  p->vruntime = 0;
+  p->tickets = DEFTICKETS;
+  p->pass = 0;
+  p->tkrtime = 0;
+  p->rtperiod = 0;
+  p->rtleft = 0;
+  p->rtmisses = 0;
+  p->cpumask = (1 << ncpu) - 1;
+
   #ifdef MLFQ
     p->cur_q = 0;
     #ifdef BONUS
@@ -184,47 +1277,156 @@ userinit(void)
   p->tf->eip = 0;  // beginning of initcode.S
 
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->cwd = namei("/");
+  if((p->files = filesalloc(namei("/"))) == 0)
+    panic("userinit: out of memory?");
 
-  // this assignment to p->state lets other cores
-  // run this process. the acquire forces the above
-  // writes to be visible, and the lock is also needed
-  // because the assignment might not be atomic.
-  acquire(&ptable.lock);
+  // queueing p lets other cores run this process.
+  // the acquire forces the above writes to be visible,
+  // and the lock is also needed because the assignment
+  // might not be atomic.
+  acquire(&p->lock);
+  setrunnable(p);
+  release(&p->lock);
+}
 
-  p->state = RUNNABLE;
+// Does another thread share p's address space?
+// Caller must hold vmlock.
+static int
+vmshared(struct proc *p)
+{
+  return p->vmnext != p;
+}
 
-  release(&ptable.lock);
+// Take p out of the threads sharing its address space.
+// Returns whether any are left.  Caller must hold vmlock.
+static int
+vmleave(struct proc *p)
+{
+  int shared;
+
+  shared = vmshared(p);
+  p->vmnext->vmprev = p->vmprev;
+  p->vmprev->vmnext = p->vmnext;
+  p->vmnext = p->vmprev = p;
+  return shared;
 }
 
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return 0 on success, -1 on failure.  Memory shared
+// with other threads can grow but not shrink.
 int
 growproc(int n)
 {
   uint sz;
   struct proc *curproc = myproc();
+  struct proc *p;
 
+  // Threads share the memory, and must all see the new size.
+  // vmlock keeps two of them from growing it at once.
+  acquire(&vmlock);
   sz = curproc->sz;
   if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Pages are allocated when first touched; see lazyfault.
+    if(sz + n >= KERNBASE || sz + n < sz){
+      release(&vmlock);
       return -1;
+    }
+    sz += n;
   } else if(n < 0){
-    if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    // Sibling threads on other cpus may still have the pages
+    // in their TLBs, and there is no shootdown to flush them.
+    if(vmshared(curproc) ||
+       (sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0){
+      release(&vmlock);
       return -1;
+    }
   }
-  curproc->sz = sz;
+  p = curproc;
+  do {
+    p->sz = sz;
+  } while((p = p->vmnext) != curproc);
+  release(&vmlock);
   switchuvm(curproc);
   return 0;
 }
 
+// Give the current process the address space pgdir of size
+// sz, for exec(), and free the one it had unless other
+// threads still use it; then the last of them to be reaped
+// frees it.
+void
+replacevm(pde_t *pgdir, uint sz)
+{
+  struct proc *curproc = myproc();
+  pde_t *oldpgdir;
+  int shared;
+
+  acquire(&vmlock);
+  oldpgdir = curproc->pgdir;
+  shared = vmleave(curproc);
+  curproc->pgdir = pgdir;
+  curproc->sz = sz;
+  release(&vmlock);
+  switchuvm(curproc);
+  if(!shared)
+    freevm(oldpgdir);
+}
+
+// Free p and its memory, if no thread still uses it.
+// p is a ZOMBIE, or an EMBRYO that could not be set up.
+// Caller must hold ptable.lock and p->lock.
+static void
+freeproc(struct proc *p)
+{
+  int shared;
+
+  kfree(p->kstack);
+  p->kstack = 0;
+  acquire(&vmlock);
+  shared = vmleave(p);
+  release(&vmlock);
+  if(p->pgdir && !shared)
+    freevm(p->pgdir);
+  p->pgdir = 0;
+  if(p->parent)
+    delchild(p);
+  pidremove(p);
+  p->pid = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->isthread = 0;
+  p->state = UNUSED;
+  procput(p);
+}
+
+// Set up np, a new process or thread, to run the current
+// process's code from its current system call, with the same
+// scheduling parameters.
+static void
+inherit(struct proc *np, struct proc *curproc)
+{
+  np->sz = curproc->sz;
+  *np->tf = *curproc->tf;
+
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  // the child asks for the same share as its parent,
+  // on the same cpus
+  np->tickets = curproc->tickets;
+  np->cpumask = curproc->cpumask;
+
+  acquire(&ptable.lock);
+  addchild(curproc, np);
+  release(&ptable.lock);
+}
+
 // Create a new process copying p as the parent.
 // Sets up stack to return as if from system call.
 // Caller must set state of returned proc to RUNNABLE.
 int
 fork(void)
 {
-  int i, pid;
+  int pid, shared;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -233,34 +1435,89 @@ fork(void)
     return -1;
   }
 
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
-    np->kstack = 0;
-    np->state = UNUSED;
+  // Share memory with the child copy-on-write.  If threads
+  // use it too, they may have writable mappings cached on
+  // other cpus, so copy it all now instead.
+  acquire(&vmlock);
+  shared = vmshared(curproc);
+  release(&vmlock);
+  if(shared)
+    np->pgdir = copyuvm(curproc->pgdir, curproc->sz);
+  else
+    np->pgdir = cowuvm(curproc->pgdir, curproc->sz);
+  if(np->pgdir == 0 || (np->files = filescopy(curproc->files)) == 0){
+    acquire(&ptable.lock);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    release(&ptable.lock);
     return -1;
   }
-  np->sz = curproc->sz;
-  np->parent = curproc;
-  *np->tf = *curproc->tf;
+  inherit(np, curproc);
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->eax = 0;
 
-  for(i = 0; i < NOFILE; i++)
-    if(curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
-  np->cwd = idup(curproc->cwd);
+  pid = np->pid;
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
 
-  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+  return pid;
+}
 
-  pid = np->pid;
+// Create a thread: a new process sharing the current one's
+// memory, open files and directory, that calls fcn(arg1,
+// arg2) on the one-page user stack at stack.  fcn must not
+// return; it should exit().  Returns the new thread's pid,
+// or -1.
+int
+clone(void (*fcn)(void*, void*), void *arg1, void *arg2, void *stack)
+{
+  int pid;
+  uint sp, ustack[3];
+  struct proc *np;
+  struct proc *curproc = myproc();
 
-  acquire(&ptable.lock);
+  if((uint)stack % 4 || (uint)stack + PGSIZE > curproc->sz ||
+     (uint)stack + PGSIZE < (uint)stack)
+    return -1;
+
+  // Start at fcn with its arguments and a fake return PC.
+  sp = (uint)stack + PGSIZE - sizeof ustack;
+  ustack[0] = 0xffffffff;
+  ustack[1] = (uint)arg1;
+  ustack[2] = (uint)arg2;
+  if(copyout(curproc->pgdir, sp, ustack, sizeof ustack) < 0)
+    return -1;
 
-  np->state = RUNNABLE;
+  // Threads must not share copy-on-write pages; see uncowuvm.
+  if(uncowuvm(curproc->pgdir, curproc->sz) < 0)
+    return -1;
 
-  release(&ptable.lock);
+  if((np = allocproc()) == 0)
+    return -1;
+  np->files = filesdup(curproc->files);
+  inherit(np, curproc);
+  acquire(&vmlock);
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  np->vmnext = curproc->vmnext;
+  np->vmprev = curproc;
+  curproc->vmnext->vmprev = np;
+  curproc->vmnext = np;
+  release(&vmlock);
+  np->isthread = 1;
+  np->ustack = stack;
+  np->tf->eip = (uint)fcn;
+  np->tf->esp = sp;
+
+  pid = np->pid;
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
 
   return pid;
 }
@@ -273,40 +1530,43 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
 
   if(curproc == initproc)
     panic("init exiting");
 
-  // Close all open files.
-  for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd]){
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
-    }
-  }
-
-  begin_op();
-  iput(curproc->cwd);
-  end_op();
-  curproc->cwd = 0;
+  // Close all open files, unless other threads share them.
+  filesput(curproc->files);
+  curproc->files = 0;
 
   curproc->etime = ticks;
 
   acquire(&ptable.lock);
 
   // Parent might be sleeping in wait().
-  wakeup1(curproc->parent);
-
-  // Pass abandoned children to init.
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->parent == curproc){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
+  wakeup(curproc->parent);
+
+  // Pass abandoned children to init.  Threads die with the
+  // process that created them, and init reaps them with wait().
+  while((p = curproc->children) != 0){
+    delchild(p);
+    addchild(initproc, p);
+    if(p->isthread){
+      p->isthread = 0;
+      kill(p->pid);
     }
+    if(p->state == ZOMBIE)
+      wakeup(initproc);
   }
   
+  // Give back any cpu reserved for the real-time class.
+  acquire(&rtlock);
+  if(curproc->rtperiod){
+    acquire(&curproc->lock);
+    rtleave(curproc);
+    release(&curproc->lock);
+  }
+  release(&rtlock);
+
   #ifdef MLFQ
     #ifdef BONUS
       // for bonus part
@@ -316,7 +1576,11 @@ exit(void)
   #endif
 
   // Jump into the scheduler, never to return.
+  // wait() can't reap us until the scheduler releases
+  // curproc->lock, which happens after we are off our stack.
+  acquire(&curproc->lock);
   curproc->state = ZOMBIE;
+  release(&ptable.lock);
   sched();
   panic("zombie exit");
 }
@@ -332,26 +1596,22 @@ wait(void)
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+    for(p = curproc->children; p; p = p->sibnext){
+      if(p->isthread)
         continue;
       havekids = 1;
+      acquire(&p->lock);
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
+        release(&p->lock);
         release(&ptable.lock);
         return pid;
       }
+      release(&p->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -360,7 +1620,7 @@ wait(void)
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    // Wait for children to exit.  (See wakeup call in exit.)
     sleep(curproc, &ptable.lock);  //DOC: wait-sleep
   }
 }
@@ -377,29 +1637,25 @@ waitx(int* wtime, int* rtime)
   
   acquire(&ptable.lock);
   for(;;){
-    // Scan through table looking for exited children.
+    // Scan through our children looking for exited ones.
     havekids = 0;
-    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+    for(p = curproc->children; p; p = p->sibnext){
+      if(p->isthread)
         continue;
       havekids = 1;
+      acquire(&p->lock);
       if(p->state == ZOMBIE){
         // Found one.
         // cprintf("->%d %d %d\n", p->ctime, p->etime, p->rtime);
         *rtime = p->rtime;
         *wtime = p->etime - p->ctime - p->rtime + 1; // total wait time // adding 1 as when process is initiated, picked by scheduler and ends in the same tick, then run time will be 1.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
+        release(&p->lock);
         release(&ptable.lock);
         return pid;
       }
+      release(&p->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -408,7 +1664,49 @@ waitx(int* wtime, int* rtime)
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    // Wait for children to exit.  (See wakeup call in exit.)
+    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+  }
+}
+
+// Wait for a thread created by this process to exit and
+// return its pid, storing the stack it was given in *stack.
+// Return -1 if this process has no threads.
+int
+join(void **stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  for(;;){
+    // Scan through our children looking for exited threads.
+    havekids = 0;
+    for(p = curproc->children; p; p = p->sibnext){
+      if(!p->isthread)
+        continue;
+      havekids = 1;
+      acquire(&p->lock);
+      if(p->state == ZOMBIE){
+        // Found one.
+        pid = p->pid;
+        *stack = p->ustack;
+        freeproc(p);
+        release(&p->lock);
+        release(&ptable.lock);
+        return pid;
+      }
+      release(&p->lock);
+    }
+
+    // No point waiting if we don't have any threads.
+    if(!havekids || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+
+    // Wait for threads to exit.  (See wakeup call in exit.)
     sleep(curproc, &ptable.lock);  //DOC: wait-sleep
   }
 }
@@ -427,207 +1725,111 @@ scheduler(void)
   struct proc *p;
   struct cpu *c = mycpu();
   c->proc = 0;
+  c->lasttick = ticks;
   
   #ifdef RR
     cprintf("---> DEFAULT\n");
-    for(;;){
-      // Enable interrupts on this processor.
-      sti();
-
-      // Loop over process table looking for process to run.
-      acquire(&ptable.lock);
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-          continue;
-
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = p;
-        switchuvm(p);
-        p->state = RUNNING;
-        
-        // custom updates
-        p->n_run++;
-        p->tmp_wtime = 0;
-        p->io = 0;
-
-        // for handling runtime in 1 tick when process is picked up by scheduler
-        if(p->tickflag != ticks){
-          p->tickflag = ticks;
-          p->rtime++;
-        }
-
-        swtch(&(c->scheduler), p->context);
-        switchkvm();
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&ptable.lock);
-    }
   #endif
   #ifdef FCFS
     cprintf("---> FCFS\n");
-    for(;;){
-      struct proc *earliestProcess = 0;
-      // Enable interrupts on this processor.
-      sti();
-
-      // Loop over process table looking for process with lowest ctime to run.
-      acquire(&ptable.lock);
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-          continue;
-        if(earliestProcess == 0){
-          earliestProcess = p;
-        }
-        else if(p->ctime < earliestProcess->ctime){
-          earliestProcess = p;
-        }
-        // cprintf("%d\n", earliestProcess->pid);
-      }
-      if(earliestProcess != 0){
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = earliestProcess;
-        switchuvm(earliestProcess);
-        earliestProcess->state = RUNNING;
-        
-        // custom updates
-        earliestProcess->n_run++;
-        earliestProcess->tmp_wtime = 0;
-        earliestProcess->io = 0;
-        // cprintf("Pid: %d running.\n", earliestProcess->pid);
-
-        // for handling runtime in 1 tick when process is picked up by scheduler
-        if(earliestProcess->tickflag != ticks){
-          earliestProcess->tickflag = ticks;
-          earliestProcess->rtime++;
-        }
-
-        swtch(&(c->scheduler), earliestProcess->context);
-        switchkvm();
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&ptable.lock);
-    }
   #endif
   #ifdef PBS
     cprintf("---> PBS\n");
-    for(;;){
-      struct proc *highestPriorityProcess = 0;
-      // Enable interrupts on this processor.
-      sti();
-
-      // Loop over process table looking for process with highest priority to run.
-      acquire(&ptable.lock);
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-          continue;
-        if(highestPriorityProcess == 0){
-          highestPriorityProcess = p;
-        }
-        else if(p->priority < highestPriorityProcess->priority){
-          highestPriorityProcess = p;
-        }
-        // cprintf("%d\n", highestPriorityProcess->pid);
-      }
-
-      if(highestPriorityProcess != 0){
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = highestPriorityProcess;
-        switchuvm(highestPriorityProcess);
-        highestPriorityProcess->state = RUNNING;
-        
-        // custom updates
-        highestPriorityProcess->n_run++;
-        highestPriorityProcess->tmp_wtime = 0;
-        highestPriorityProcess->io = 0;
-
-        // for handling runtime in 1 tick when process is picked up by scheduler
-        if(highestPriorityProcess->tickflag != ticks){
-          highestPriorityProcess->tickflag = ticks;
-          highestPriorityProcess->rtime++;
-        }
-
-        swtch(&(c->scheduler), highestPriorityProcess->context);
-        switchkvm();
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&ptable.lock);
-    }
   #endif
   #ifdef MLFQ
     cprintf("---> MLFQ\n");
-    for(;;){
-      struct proc *highestPriorityProcess = 0;
-      // Enable interrupts on this processor.
-      sti();
-
-      // Loop over process table looking for process with highest priority to run.
-      acquire(&ptable.lock);
-      for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-        if(p->state != RUNNABLE)
-          continue;
-        if(highestPriorityProcess == 0){
-          highestPriorityProcess = p;
-        }
-        else if(p->cur_q < highestPriorityProcess->cur_q){
-          highestPriorityProcess = p;
-        }
-        else if(p->cur_q == highestPriorityProcess->cur_q){
-          if(p->position_priority < highestPriorityProcess->position_priority){
-            highestPriorityProcess = p;
-          }
-        }
-        // cprintf("%d\n", highestPriorityProcess->pid);
-      }
+  #endif
+  #ifdef CFS
+    cprintf("---> CFS\n");
+  #endif
+  #ifdef STRIDE
+    cprintf("---> STRIDE\n");
+  #endif
 
-      if(highestPriorityProcess != 0){
-        // Switch to chosen process.  It is the process's job
-        // to release ptable.lock and then reacquire it
-        // before jumping back to us.
-        c->proc = highestPriorityProcess;
-        switchuvm(highestPriorityProcess);
-        highestPriorityProcess->state = RUNNING;
-        
-        // custom updates
-        highestPriorityProcess->n_run++;
-        highestPriorityProcess->tmp_wtime = 0;
-        highestPriorityProcess->io = 0;
-
-        // for handling runtime in 1 tick when process is picked up by scheduler
-        if(highestPriorityProcess->tickflag != ticks){
-          highestPriorityProcess->tickflag = ticks;
-          highestPriorityProcess->rtime++;
-          // number of ticks a process received in its queue
-          highestPriorityProcess->q[highestPriorityProcess->cur_q]++;
-        }
+  for(;;){
+    // Enable interrupts on this processor.
+    sti();
+
+    // The run queue is kept in policy order (see rqbefore),
+    // so the process to run is at its head.
+    // If there is nothing to run here, help the busiest cpu.
+    // If there is nothing to steal either, zero a free page
+    // for kalloc_zeroed(), one at a time so new work is not
+    // kept waiting, and once there is nothing left to zero halt
+    // until an interrupt arrives instead of spinning on the queues.
+    if((p = rqpick(c)) == 0 && (p = rqsteal(c)) == 0){
+      if(kzeroidle())
+        continue;
+      cli();
+      if(c->rq.nready == 0){
+        retick(c);
+        stihlt();
+      }
+      continue;
+    }
 
-        swtch(&(c->scheduler), highestPriorityProcess->context);
-        switchkvm();
+    // Switch to chosen process.  It is the process's job
+    // to release p->lock and then reacquire it
+    // before jumping back to us.
+    acquire(&p->lock);
+    cputime(c);
+    c->proc = p;
+    c->resched = 0;
+    retick(c);
+    switchuvm(p);
+    p->state = RUNNING;
+    p->lastcpu = c;
+
+    // custom updates
+    p->n_run++;
+    p->wstart = ticks;
+
+    #ifndef MLFQ
+      // ticks run this turn (MLFQ counts across turns)
+      p->timeslice = 0;
+    #endif
+    #ifdef CFS
+      // p's share of the latency, against what is still queued
+      p->slice = CFS_LATENCY * quantum * p->weight / (c->rq.load + p->weight);
+      if(p->slice < CFS_MINGRAN * quantum)
+        p->slice = CFS_MINGRAN * quantum;
+      acquire(&c->rq.lock);
+      updminvrun(c, p);
+      release(&c->rq.lock);
+    #endif
+    #ifdef STRIDE
+      // the queue is in pass order, so p's is the lowest here
+      c->rq.minpass = p->pass;
+    #endif
 
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
-      }
-      release(&ptable.lock);
+    // for handling runtime in 1 tick when process is picked up by scheduler
+    if(p->tickflag != ticks){
+      p->tickflag = ticks;
+      p->rtime++;
+      #ifdef MLFQ
+        // number of ticks a process received in its queue
+        p->q[p->cur_q]++;
+      #endif
+      #ifdef CFS
+        p->vruntime += vdelta(p);
+      #endif
+      #ifdef STRIDE
+        p->pass += STRIDE1 / p->tickets;
+      #endif
     }
-  #endif
+
+    swtch(&(c->scheduler), p->context);
+    switchkvm();
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    cputime(c);
+    c->proc = 0;
+    release(&p->lock);
+  }
 }
 
-// Enter scheduler.  Must hold only ptable.lock
+// Enter scheduler.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -640,8 +1842,8 @@ sched(void)
   int intena;
   struct proc *p = myproc();
 
-  if(!holding(&ptable.lock))
-    panic("sched ptable.lock");
+  if(!holding(&p->lock))
+    panic("sched p->lock");
   if(mycpu()->ncli != 1)
     panic("sched locks");
   if(p->state == RUNNING)
@@ -657,10 +1859,12 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&ptable.lock);  //DOC: yieldlock
-  myproc()->state = RUNNABLE;
+  struct proc *p = myproc();
+
+  acquire(&p->lock);  //DOC: yieldlock
+  setrunnable(p);
   sched();
-  release(&ptable.lock);
+  release(&p->lock);
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -669,8 +1873,8 @@ void
 forkret(void)
 {
   static int first = 1;
-  // Still holding ptable.lock from scheduler.
-  release(&ptable.lock);
+  // Still holding p->lock from scheduler.
+  release(&myproc()->lock);
 
   if (first) {
     // Some initialization functions must be run in the context
@@ -690,6 +1894,7 @@ void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq;
   
   if(p == 0)
     panic("sleep");
@@ -697,66 +1902,92 @@ sleep(void *chan, struct spinlock *lk)
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire ptable.lock in order to
-  // change p->state and then call sched.
-  // Once we hold ptable.lock, we can be
+  // Must acquire chan's sleep queue lock and p->lock
+  // in order to queue p, change p->state and then
+  // call sched.  Once we hold the queue lock, we can be
   // guaranteed that we won't miss any wakeup
-  // (wakeup runs with ptable.lock locked),
+  // (wakeup runs with it locked),
   // so it's okay to release lk.
-  if(lk != &ptable.lock){  //DOC: sleeplock0
-    acquire(&ptable.lock);  //DOC: sleeplock1
-    release(lk);
-  }
+  sq = chanq(chan);
+  acquire(&sq->lock);  //DOC: sleeplock1
+  acquire(&p->lock);
+  release(lk);
 
-  #ifdef MLFQ
-    // Process goes to sleep if it waits for io
-    // Hence it is pushed at the end of queue i.e. the maximum value of position_priority is allocated 
-    if(p->io == 0){
-      p->io = 1;
-      p->position_priority = 1 + proc_queue[p->cur_q].largest_position;
-      proc_queue[p->cur_q].largest_position = p->position_priority;
-      // for bonus part
-      // cprintf("%d,%d,%d,IO\n", p->pid, p->cur_q, ticks);
-      // cprintf("-> [%d] %d %d (IO)\n", p->pid, p->cur_q, ticks);
-    }
-  #endif
+  // Under MLFQ a process that gives up the cpu for io keeps
+  // its queue, and goes to the end of it when it wakes up.
 
   // Go to sleep.
   p->chan = chan;
   p->state = SLEEPING;
-
+  p->sqprev = 0;
+  p->sqnext = sq->head;
+  if(sq->head)
+    sq->head->sqprev = p;
+  sq->head = p;
+  release(&sq->lock);
+
+  // Whoever wakes us takes us off sq, and has to
+  // wait for p->lock until we are off our stack.
   sched();
 
   // Tidy up.
   p->chan = 0;
 
   // Reacquire original lock.
-  if(lk != &ptable.lock){  //DOC: sleeplock2
-    release(&ptable.lock);
-    acquire(lk);
-  }
+  release(&p->lock);
+  acquire(lk);
 }
 
-//PAGEBREAK!
-// Wake up all processes sleeping on chan.
-// The ptable lock must be held.
+// Take p off sleep queue sq and make it runnable.
+// Caller must hold sq->lock and p->lock.
 static void
-wakeup1(void *chan)
+sqwake(struct sleepq *sq, struct proc *p)
 {
-  struct proc *p;
+  if(p->sqprev)
+    p->sqprev->sqnext = p->sqnext;
+  else
+    sq->head = p->sqnext;
+  if(p->sqnext)
+    p->sqnext->sqprev = p->sqprev;
+  p->sqnext = p->sqprev = 0;
+  setrunnable(p);
+}
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+//PAGEBREAK!
+// Wake up at most n processes sleeping on chan, those that
+// have slept longest first, and return how many were woken.
+// Only the processes hashed to chan's queue are looked at.
+int
+wakeupn(void *chan, int n)
+{
+  struct sleepq *sq;
+  struct proc *p, *prev;
+  int woken;
+
+  sq = chanq(chan);
+  acquire(&sq->lock);
+  // sleep() adds at the head, so start from the tail.
+  for(p = sq->head; p && p->sqnext; p = p->sqnext)
+    ;
+  woken = 0;
+  for(; p && woken < n; p = prev){
+    prev = p->sqprev;
+    if(p->chan == chan){
+      acquire(&p->lock);
+      sqwake(sq, p);
+      release(&p->lock);
+      woken++;
+    }
+  }
+  release(&sq->lock);
+  return woken;
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-  acquire(&ptable.lock);
-  wakeup1(chan);
-  release(&ptable.lock);
+  wakeupn(chan, maxproc);
 }
 
 // Kill the process with the given pid.
@@ -766,20 +1997,29 @@ int
 kill(int pid)
 {
   struct proc *p;
+  struct sleepq *sq;
+  void *chan;
 
-  acquire(&ptable.lock);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->pid == pid){
-      p->killed = 1;
-      // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
-      release(&ptable.lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0)
+    return -1;
+  p->killed = 1;
+  if(p->state != SLEEPING){
+    release(&p->lock);
+    return 0;
   }
-  release(&ptable.lock);
-  return -1;
+  // Wake process from sleep.  The sleep queue lock
+  // comes before p->lock, so drop and retake it, and
+  // leave p alone if it woke up in between.
+  chan = p->chan;
+  release(&p->lock);
+  sq = chanq(chan);
+  acquire(&sq->lock);
+  acquire(&p->lock);
+  if(p->state == SLEEPING && p->chan == chan)
+    sqwake(sq, p);
+  release(&p->lock);
+  release(&sq->lock);
+  return 0;
 }
 
 //PAGEBREAK: 36
@@ -802,7 +2042,7 @@ procdump(void)
   char *state;
   uint pc[10];
 
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->next){
     if(p->state == UNUSED)
       continue;
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
@@ -819,50 +2059,59 @@ procdump(void)
   }
 }
 
-// To update running time of the process per clock tick
+// Per-tick accounting, called from every cpu's own timer
+// interrupt.  Each cpu only charges the process it is running,
+// so no locks are needed and the cost does not grow with the
+// number of processes.
+// Wait times are not counted here; they are worked out from
+// p->wstart when they are needed.
 void updateruntime(void){
-  acquire(&ptable.lock);
-  struct proc * p;
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state == RUNNING){
-      p->rtime++;
-      p->tmp_wtime = 0;
-      p->tickflag = ticks;
-
-      #ifdef MLFQ
-        // number of ticks a process received in its queue
-        p->q[p->cur_q]++;
-      #endif
-    }
-    else if(p->state != UNUSED){
-      p->tmp_wtime++;
-    }
-     
+  struct cpu * c = mycpu();
+  struct proc * p = c->proc;
+  int n;
+
+  // utilization of this cpu
+  cputime(c);
+
+  // charge p for the ticks since it was last charged; there
+  // can be several if the timer was slowed (see retick), and
+  // the scheduler may already have charged p for this one
+  if(p && p->tickflag != ticks){
+    n = ticks - p->tickflag;
+    p->tickflag = ticks;
+    p->rtime += n;
     #ifdef MLFQ
-      if(p->state != UNUSED){
-        // for aging
-        if(p->tmp_wtime > AGE_CUTOFF){
-          // priority is increased
-          if(p->cur_q != 0){
-            // change in queue
-            p->cur_q--;
-            // to push to end
-            p->position_priority = 1+proc_queue[p->cur_q].largest_position;
-            proc_queue[p->cur_q].largest_position = p->position_priority;
-            p->tmp_wtime = 0;
-
-            #ifdef BONUS
-              // for bonus part
-              cprintf("%d,%d,%d,Aging\n", p->pid, p->cur_q, ticks);
-              // cprintf("-> [%d] %d %d (Aging)\n", p->pid, p->cur_q, ticks);
-            #endif
-          }
-
-        }
-      }
+      // number of ticks a process received in its queue
+      p->q[p->cur_q] += n;
+    #endif
+    #ifdef CFS
+      p->vruntime += n * vdelta(p);
+    #endif
+    #ifdef STRIDE
+      p->pass += n * (STRIDE1 / p->tickets);
     #endif
   }
-  release(&ptable.lock);
+  if(p)
+    p->wstart = ticks;
+
+  // charge a real-time process's runtime, whatever level it
+  // was queued at; finishing it after the deadline is a miss too
+  if(p && isrt(p)){
+    if(--p->rtleft == 0 && (int)(ticks - p->rtdl) > 0)
+      p->rtmisses++;
+  }
+  rtperiods(c);
+
+  #ifdef MLFQ
+    age(c);
+  #endif
+  #ifdef CFS
+    acquire(&c->rq.lock);
+    updminvrun(c, p);
+    release(&c->rq.lock);
+  #endif
+  balance(c);
+  retick(c);
 }
 
 // To print details regarding each process
@@ -878,13 +2127,13 @@ void procdetails(void){
   acquire(&ptable.lock);
   cprintf("PID\tPriority\tState\tr_time\tw_time\tn_run\tcur_q\tq0\tq1\tq2\tq3\tq4\n");
   struct proc * p;
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+  for(p = ptable.list; p; p = p->next){
     if(p->state != UNUSED){
       cprintf("%d\t", p->pid);
       cprintf("%d\t\t", p->priority);
       cprintf("%s\t", states[p->state]);
       cprintf("%d\t", p->rtime);
-      cprintf("%d\t", p->tmp_wtime);
+      cprintf("%d\t", p->state == RUNNING ? 0 : ticks - p->wstart);
       cprintf("%d\t", p->n_run);
       cprintf("%d\t", p->cur_q);
       for(int i=0; i<5; i++){
@@ -893,13 +2142,58 @@ void procdetails(void){
       cprintf("\n");
     }
   }
+
+  #ifdef STRIDE
+    // Share of the cpu time asked for (tickets) and received
+    // by each process competing for it now.  Run time is only
+    // counted since its tickets were last set, so time run
+    // against other competitors or for another share is left out.
+    uint ntickets = 0, nrtime = 0;
+    for(p = ptable.list; p; p = p->next){
+      if(p->state == RUNNABLE || p->state == RUNNING){
+        ntickets += p->tickets;
+        nrtime += p->rtime - p->tkrtime;
+      }
+    }
+    cprintf("PID\tTickets\tWanted%%\tGot%%\n");
+    for(p = ptable.list; p; p = p->next){
+      if(p->state == RUNNABLE || p->state == RUNNING){
+        cprintf("%d\t%d\t%d\t%d\n", p->pid, p->tickets,
+                100*p->tickets/ntickets,
+                nrtime ? 100*(p->rtime - p->tkrtime)/nrtime : 0);
+      }
+    }
+  #endif
+
+  // real-time processes
+  acquire(&rtlock);
+  if(rtlist)
+    cprintf("PID\tRuntime\tPeriod\tDeadline\tCPU\tMisses\n");
+  for(p = rtlist; p; p = p->rtnext){
+    cprintf("%d\t%d\t%d\t%d\t\t%d\t%d\n", p->pid, p->rtruntime, p->rtperiod,
+            p->rtdeadline, p->rtcpu-cpus, p->rtmisses);
+  }
+  release(&rtlock);
   release(&ptable.lock);
+
+  struct cpu * c;
+  cprintf("CPU\tQueued\tSteals\tMigrations\tIdle\tBusy%%\tRT%%\tTick\n");
+  for(c = cpus; c < cpus+ncpu; c++){
+    cprintf("%d\t%d\t%d\t%d\t\t", c-cpus, c->rq.nready, c->rq.nsteal, c->rq.nmigrate);
+    cprintf("%d\t%d\t", c->idleticks, c->nticks ? 100*(c->nticks - c->idleticks)/c->nticks : 0);
+    cprintf("%d\t%s\n", c->rq.rtutil/10, c->tickstopped ? "off" : "on");
+  }
+  cprintf("%d ticks a second, quantum %d ticks, tickless %s\n",
+          hz, quantum, tickless ? "on" : "off");
+  cprintf("%d processes, limit %d, in %d pages\n",
+          ptable.nproc, maxproc, ptable.npages);
+  kallocdump();
+  slabdump();
 }
 
 // To set priority of a process
 int 
 set_priority(int new_priority, int pid){
-  acquire(&ptable.lock);
   struct proc * p;
   int oldPriority = -1;
 
@@ -912,15 +2206,170 @@ set_priority(int new_priority, int pid){
   }
 
   // cprintf("%d %d\n", new_priority, pid);
-  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-    if(p->state != UNUSED){
-      if(p->pid == pid){
-        oldPriority = p->priority;
-        p->priority = new_priority;
-        break;
+  if((p = findproc(pid)) != 0){
+    oldPriority = p->priority;
+    p->priority = new_priority;
+    // its place in the run queue may depend on priority
+    rqupdate(p);
+    // a raised priority may preempt what its cpu is running,
+    // a lowered one may let a waiting process preempt it
+    if(p->rqcpu)
+      kick(p->rqcpu, p);
+    #ifdef PBS
+      else if(p->state == RUNNING && new_priority > oldPriority)
+        preempt(p->lastcpu);
+    #endif
+    release(&p->lock);
+  }
+  return oldPriority;
+}
+
+// To set the stride scheduling tickets of a process
+int
+set_tickets(int new_tickets, int pid){
+  struct proc * p;
+  int oldTickets = -1;
+
+  // a process always holds at least one ticket
+  if(new_tickets < 1){
+    new_tickets = 1;
+  }
+  else if(new_tickets > MAXTICKETS){
+    new_tickets = MAXTICKETS;
+  }
+
+  if((p = findproc(pid)) != 0){
+    // takes effect from its next tick
+    oldTickets = p->tickets;
+    p->tickets = new_tickets;
+    p->tkrtime = p->rtime;
+    release(&p->lock);
+  }
+  return oldTickets;
+}
+
+// To put a process in the real-time class, needing runtime
+// ticks of cpu by deadline ticks into every period.
+// A runtime of 0 takes it out again.
+// Returns -1 if there is no such process, the parameters are
+// inconsistent, or no cpu has enough left to guarantee them;
+// in the last case the process is left out of the class.
+int
+set_deadline(int runtime, int period, int deadline, int pid){
+  struct proc * p;
+  struct cpu * c, * best;
+  int util, ret = -1;
+
+  if(runtime < 0 || (runtime > 0 && (runtime > deadline || deadline > period)))
+    return -1;
+  util = runtime ? (1000*runtime + deadline-1) / deadline : 0;
+
+  // ptable.lock keeps p from exiting while it is admitted
+  acquire(&ptable.lock);
+  acquire(&rtlock);
+  if((p = findproc(pid)) != 0){
+    if(p->state != ZOMBIE){
+      if(p->rtperiod)
+        rtleave(p);
+      if(runtime == 0){
+        ret = 0;
+      } else {
+        // admit it on the cpu with the most left
+        best = 0;
+        for(c = cpus; c < cpus+ncpu; c++)
+          if(allowed(p, c) && (best == 0 || c->rq.rtutil < best->rq.rtutil))
+            best = c;
+        if(best && best->rq.rtutil + util <= RTMAXUTIL){
+          best->rq.rtutil += util;
+          p->rtutil = util;
+          p->rtcpu = best;
+          p->rtruntime = runtime;
+          p->rtperiod = period;
+          p->rtdeadline = deadline;
+          p->rtrelease = ticks + period;
+          p->rtdl = ticks + deadline;
+          p->rtleft = runtime;
+          p->rtnext = rtlist;
+          rtlist = p;
+          requeue(p);
+          ret = 0;
+        }
       }
     }
+    release(&p->lock);
   }
+  release(&rtlock);
   release(&ptable.lock);
-  return oldPriority;
-}
\ No newline at end of file
+  return ret;
+}
+
+// To restrict a process to the cpus in mask, bit i for cpu i.
+// Returns the old mask, or -1 if there is no such process, the
+// mask has no cpu, or it leaves out the cpu the process was
+// admitted on as a real-time process.
+int
+set_affinity(int mask, int pid){
+  struct proc * p;
+  int oldMask = -1;
+
+  mask &= (1 << ncpu) - 1;
+  if(mask == 0)
+    return -1;
+
+  acquire(&rtlock);
+  if((p = findproc(pid)) != 0){
+    if(p->rtperiod == 0 || ((mask >> (p->rtcpu - cpus)) & 1)){
+      oldMask = p->cpumask;
+      p->cpumask = mask;
+      // move it if it is queued or running where it may not be
+      if(p->rqcpu && !allowed(p, p->rqcpu))
+        requeue(p);
+      else if(p->state == RUNNING && !allowed(p, p->lastcpu))
+        preempt(p->lastcpu);
+    }
+    release(&p->lock);
+  }
+  release(&rtlock);
+  return oldMask;
+}
+
+// To get the mask of cpus a process may run on
+int
+get_affinity(int pid){
+  struct proc * p;
+  int mask = -1;
+
+  if((p = findproc(pid)) != 0){
+    mask = p->cpumask;
+    release(&p->lock);
+  }
+  return mask;
+}
+
+// To change the tick rate and the base time slice, and turn
+// tickless mode on or off.  A rate or slice of 0, or a mode
+// of -1, leaves it as it is.  Each cpu reprograms its timer
+// at its next interrupt.
+int
+set_clock(int new_hz, int new_quantum, int new_tickless){
+  if(new_hz != 0 && (new_hz < 10 || new_hz > 1000))
+    return -1;
+  if(new_quantum != 0 && (new_quantum < 1 || new_quantum > 100))
+    return -1;
+  if(new_tickless < -1 || new_tickless > 1)
+    return -1;
+
+  if(new_hz)
+    hz = new_hz;
+  if(new_quantum){
+    quantum = new_quantum;
+    #ifdef MLFQ
+      for(int i=0; i<NQUEUE; i++){
+        proc_queue[i].timeslice_cutoff = (quantum << i);
+      }
+    #endif
+  }
+  if(new_tickless != -1)
+    tickless = new_tickless;
+  return 0;
+}
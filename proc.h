@@ -1,3 +1,29 @@
+#define NQUEUE 5  // number of MLFQ queues
+#define RTLEVEL NQUEUE  // run queue level of the real-time (EDF) class
+
+// Per-CPU queue of RUNNABLE processes.
+// MLFQ keeps one FIFO per queue level; the other policies
+// use only level 0, kept in the order they want processes run.
+// The scheduler takes the head of the lowest non-empty level.
+// CFS keeps its processes in a red-black tree instead.
+// Real-time processes wait on level RTLEVEL, in deadline
+// order, and run ahead of all the others.
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NQUEUE+1]; // Next process to run at each level
+  struct proc *tail[NQUEUE+1];
+  uint nonempty;               // Bitmap of levels with processes queued
+  int nready;                  // Number of processes on the queue
+  uint nsteal;                 // Processes taken from other cpus while idle
+  uint nmigrate;               // Processes pulled here by periodic balancing
+  struct proc *root;           // CFS: tree of processes ordered by vruntime
+  struct proc *leftmost;       // CFS: smallest vruntime in the tree
+  uint load;                   // CFS: total weight of the processes queued
+  uint minvrun;                // CFS: never decreasing floor of vruntimes here
+  uint minpass;                // STRIDE: pass of the process last run here
+  int rtutil;                  // Per mille of the cpu reserved by real-time processes
+};
+
 // Per-CPU state
 struct cpu {
   uchar apicid;                // Local APIC ID
@@ -8,6 +34,13 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  struct runq rq;              // Processes waiting to run on this cpu
+  uint nticks;                 // Ticks accounted for by this cpu
+  uint idleticks;              // How many of those it was idle
+  uint lasttick;               // Tick it last accounted up to
+  int hz;                      // Rate its timer was last set for
+  int tickstopped;             // Timer stopped or slowed, as nothing else is queued
+  int resched;                 // A process that preempts proc was queued here
 };
 
 extern struct cpu cpus[NCPU];
@@ -36,40 +69,75 @@ enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
+  struct spinlock lock;        // Protects state, chan, killed and run queue links
+  struct proc *next;           // On the list of processes, or the free list
+  struct proc *prev;
   uint sz;                     // Size of process memory (bytes)
   pde_t* pgdir;                // Page table
+  struct proc *vmnext;         // Ring of threads sharing pgdir
+  struct proc *vmprev;
   char *kstack;                // Bottom of kernel stack for this process
   enum procstate state;        // Process state
   int pid;                     // Process ID
   struct proc *parent;         // Parent process
+  struct proc *children;       // Its children, linked through sibnext
+  struct proc *sibnext;        // Sibling links, on its parent's children
+  struct proc *sibprev;
+  struct proc *pidnext;        // Next in its pid hash chain
   struct trapframe *tf;        // Trap frame for current syscall
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
-  struct inode *cwd;           // Current directory
+  struct files *files;         // Open files and current directory
   char name[16];               // Process name (debugging)
   int ctime;                   // Process Creation Time
   int etime;                   // Process End Time
   int rtime;                   // Process Total Time
-  int tmp_wtime;               // Process Wait Time (if a process is running)
+  uint wstart;                 // Tick it last ran, or was aged; wait time is counted from here
   int priority;                // Priority of the process
   int n_run;                   // Number of times the process was picked by the scheduler
   int cur_q;                   // Current queue number (1-5)
   int q[5];                    // Number of ticks the process has received at each of the 5 queues
   int timeslice;               // Timeslice for mlfq
-  int position_priority;       // Position in each queue
-  int io;                      // For handling IO
   int tickflag;                // Flag for handling run time if scheduler picks the process in the same tick
+  struct proc *rqnext;         // Run queue links
+  struct proc *rqprev;
+  struct cpu *rqcpu;           // Cpu whose run queue holds us, or 0
+  int rqlevel;                 // Run queue level we are queued at
+  struct cpu *lastcpu;         // Cpu we last ran on
+  struct proc *sqnext;         // Sleep queue links, while SLEEPING
+  struct proc *sqprev;
+  uint vruntime;               // CFS: run time scaled by weight
+  uint weight;                 // CFS: weight from priority, as last queued
+  int slice;                   // CFS: ticks it may run before yielding
+  struct proc *rbparent;       // CFS: run queue tree links
+  struct proc *rbleft;
+  struct proc *rbright;
+  int rbred;
+  int tickets;                 // STRIDE: share of the cpu asked for
+  uint pass;                   // STRIDE: advanced by STRIDE1/tickets per tick run
+  int tkrtime;                 // STRIDE: rtime when its tickets were last set
+  int rtperiod;                // Real-time: period in ticks, or 0 if not real-time
+  int rtruntime;               // Real-time: ticks of cpu wanted every period
+  int rtdeadline;              // Real-time: ticks into the period they are due by
+  int rtutil;                  // Real-time: per mille of rtcpu reserved
+  int rtleft;                  // Real-time: ticks of runtime left this period
+  uint rtrelease;              // Real-time: tick the next period starts
+  uint rtdl;                   // Real-time: tick this period's runtime is due
+  int rtmisses;                // Real-time: deadlines missed
+  struct cpu *rtcpu;           // Real-time: cpu it was admitted on
+  struct proc *rtnext;         // Real-time: next on rtlist
+  uint cpumask;                // Cpus it may run on, bit i for cpus[i]
+  int isthread;                // Made by clone(), sharing its parent's memory
+  void *ustack;                // Thread: user stack given to clone()
 };
 
 struct procQueue {
   int timeslice_cutoff;
-  int largest_position;
 };
 
 void updateruntime(void);
-extern struct procQueue proc_queue[5];
+extern struct procQueue proc_queue[NQUEUE];
 
 // Process memory is laid out contiguously, low addresses first:
 //   text
@@ -0,0 +1,49 @@
+#include "types.h"
+#include "user.h"
+#include "stat.h"
+#include "fs.h"
+
+// setAffinity pid: print the cpus pid may run on.
+// setAffinity mask pid: restrict pid to the cpus in mask,
+// bit i for cpu i (so 5 is cpus 0 and 2).
+int main(int argc, char *argv[]){
+    if(argc < 2){
+        printf(1, "Unsufficient arguments supplied\n");
+        exit();
+    }
+    else if(argc == 2){
+        int pid = atoi(argv[1]);
+        int mask = get_affinity(pid);
+        if(mask == -1 || argv[1][0] == '-'){
+            printf(1, "Error, Process with pid %s does not exist.\n", argv[1]);
+        }
+        else{
+            printf(1, "Affinity of pid %d: %d\n", pid, mask);
+        }
+        exit();
+    }
+    else{
+        int new_mask = atoi(argv[1]);
+        int pid = atoi(argv[2]);
+        if(argv[2][0] == '-'){
+            printf(1, "Error, Process id should be positive.\n");
+            printf(1, "Affinity is not updated.\n");
+        }
+        else if(new_mask <= 0 || argv[1][0] == '-'){
+            printf(1, "Error, Mask should have at least one cpu.\n");
+            printf(1, "Affinity is not updated.\n");
+        }
+        else{
+            int old_mask = set_affinity(new_mask, pid);
+            if(old_mask != -1){
+                printf(1, "Affinity of pid %d updated.\n", pid);
+                printf(1, "Old mask: %d\n", old_mask);
+            }
+            else{
+                printf(1, "Error, No such process, no such cpu, or the cpu of a real-time process left out.\n");
+                printf(1, "Affinity is not updated.\n");
+            }
+        }
+        exit();
+    }
+}
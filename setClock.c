@@ -0,0 +1,31 @@
+#include "types.h"
+#include "user.h"
+#include "stat.h"
+#include "fs.h"
+
+// setClock hz quantum [tickless]
+// A hz or quantum of 0 keeps the current one; tickless is 0 or 1.
+// ps shows the current settings.
+int main(int argc, char *argv[]){
+    if(argc < 3){
+        printf(1, "Usage: setClock hz quantum [tickless]\n");
+        exit();
+    }
+    else{
+        int new_hz = atoi(argv[1]);
+        int new_quantum = atoi(argv[2]);
+        int new_tickless = argc > 3 ? atoi(argv[3]) : -1;
+        if(argv[1][0] == '-' || argv[2][0] == '-' || (argc > 3 && argv[3][0] == '-')){
+            printf(1, "Error, Values should be positive.\n");
+            printf(1, "Clock is not updated.\n");
+        }
+        else if(set_clock(new_hz, new_quantum, new_tickless) < 0){
+            printf(1, "Error, Need hz in [10,1000], quantum in [1,100] and tickless 0 or 1.\n");
+            printf(1, "Clock is not updated.\n");
+        }
+        else{
+            printf(1, "Clock updated.\n");
+        }
+        exit();
+    }
+}
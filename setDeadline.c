@@ -0,0 +1,34 @@
+#include "types.h"
+#include "user.h"
+#include "stat.h"
+#include "fs.h"
+
+int main(int argc, char *argv[]){
+    if(argc < 5){
+        printf(1, "Usage: setDeadline runtime period deadline pid\n");
+        printf(1, "A runtime of 0 makes the process an ordinary one again.\n");
+        exit();
+    }
+    else{
+        int runtime = atoi(argv[1]);
+        int period = atoi(argv[2]);
+        int deadline = atoi(argv[3]);
+        int pid = atoi(argv[4]);
+        if(argv[4][0] == '-'){
+            printf(1, "Error, Process id should be positive.\n");
+        }
+        else if(runtime > 0 && (runtime > deadline || deadline > period)){
+            printf(1, "Error, Need runtime <= deadline <= period.\n");
+        }
+        else if(set_deadline(runtime, period, deadline, pid) < 0){
+            printf(1, "Error, Process with pid %d does not exist or cannot be admitted.\n", pid);
+        }
+        else if(runtime > 0){
+            printf(1, "pid %d gets %d ticks by tick %d of every %d.\n", pid, runtime, deadline, period);
+        }
+        else{
+            printf(1, "pid %d is no longer real-time.\n", pid);
+        }
+        exit();
+    }
+}
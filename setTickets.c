@@ -0,0 +1,37 @@
+#include "types.h"
+#include "user.h"
+#include "stat.h"
+#include "fs.h"
+
+int main(int argc, char *argv[]){
+    if(argc < 3){
+        printf(1, "Unsufficient arguments supplied\n");
+        exit();
+    }
+    else{
+        int new_tickets = atoi(argv[1]);
+        int pid = atoi(argv[2]);
+        if(argv[2][0] == '-'){
+            printf(1, "Error, Process id should be positive.\n");
+            printf(1, "Tickets are not updated.\n");
+        }
+        else{
+            if(new_tickets >= 1 && new_tickets <= 10000 && argv[1][0] != '-'){
+                int old_tickets = set_tickets(new_tickets, pid);
+                if(old_tickets != -1){
+                    printf(1, "Tickets of pid %d updated.\n", pid);
+                    printf(1, "Old tickets: %d\n", old_tickets);
+                }
+                else{
+                    printf(1, "Error, Process with pid %d does not exist.\n", pid);
+                    printf(1, "Tickets are not updated.\n");
+                }
+            }
+            else{
+                printf(1, "Error, Tickets should be a value in the range [1,10000].\n");
+                printf(1, "Tickets are not updated.\n");
+            }
+        }
+        exit();
+    }
+}
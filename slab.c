@@ -0,0 +1,179 @@
+// Slab allocator for small kernel objects: open files,
+// inodes, pipes and buffers.
+//
+// Each cache hands out objects of one size, carved out of
+// pages from kalloc().  A page of objects, a slab, starts
+// with a struct slab, so the slab an object belongs to is
+// found by rounding its address down.  Free objects in a
+// slab are linked through their first word.
+//
+// slaballoc() and slabfree() use the current cpu's magazine
+// of free objects, with interrupts off, and only take the
+// cache's lock to refill or flush half a magazine at a time.
+// A slab with no objects in use is given back to kalloc(),
+// unless it is the only one with free objects.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "slab.h"
+
+struct slab {
+  struct slab *next;           // On its cache's partial list
+  struct slab *prev;
+  void *free;                  // Free objects
+  int inuse;                   // Objects not free
+};
+
+// All caches, for slabdump().
+static struct slabcache *caches;
+
+void
+slabinit(struct slabcache *c, char *name, uint size)
+{
+  initlock(&c->lock, name);
+  c->name = name;
+  c->size = (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+  c->perslab = (PGSIZE - sizeof(struct slab)) / c->size;
+  if(c->perslab < 1)
+    panic("slabinit: object too big");
+  c->next = caches;
+  caches = c;
+}
+
+static void
+linkslab(struct slabcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+static void
+unlinkslab(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Fill up to half of m from the slabs, making new ones as
+// needed.  Caller has interrupts off.
+static void
+refillmag(struct slabcache *c, struct magazine *m)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  acquire(&c->lock);
+  while(m->n < MAGSIZE/2){
+    if((s = c->partial) == 0){
+      if((s = (struct slab*)kalloc()) == 0)
+        break;
+      s->free = 0;
+      s->inuse = 0;
+      obj = (char*)s + PGSIZE - c->perslab*c->size;
+      for(i = 0; i < c->perslab; i++, obj += c->size){
+        *(void**)obj = s->free;
+        s->free = obj;
+      }
+      linkslab(c, s);
+      c->nslab++;
+    }
+    obj = s->free;
+    s->free = *(void**)obj;
+    s->inuse++;
+    if(s->free == 0)
+      unlinkslab(c, s);
+    m->obj[m->n++] = obj;
+    c->nobj++;
+  }
+  release(&c->lock);
+}
+
+// Give n objects from m back to their slabs.
+// Caller has interrupts off.
+static void
+flushmag(struct slabcache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  acquire(&c->lock);
+  while(n-- > 0 && m->n > 0){
+    obj = m->obj[--m->n];
+    s = (struct slab*)PGROUNDDOWN((uint)obj);
+    if(s->free == 0)
+      linkslab(c, s);
+    *(void**)obj = s->free;
+    s->free = obj;
+    s->inuse--;
+    c->nobj--;
+    if(s->inuse == 0 && (s->next || s->prev)){
+      unlinkslab(c, s);
+      c->nslab--;
+      kfree((char*)s);
+    }
+  }
+  release(&c->lock);
+}
+
+// Allocate a zeroed object from c.
+// Returns 0 if there is no memory.
+void*
+slaballoc(struct slabcache *c)
+{
+  struct magazine *m;
+  void *obj;
+
+  obj = 0;
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == 0)
+    refillmag(c, m);
+  if(m->n > 0)
+    obj = m->obj[--m->n];
+  popcli();
+  if(obj)
+    memset(obj, 0, c->size);
+  return obj;
+}
+
+// Free obj, which came from slaballoc(c).
+void
+slabfree(struct slabcache *c, void *obj)
+{
+  struct magazine *m;
+
+  pushcli();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE)
+    flushmag(c, m, MAGSIZE/2);
+  m->obj[m->n++] = obj;
+  popcli();
+}
+
+// Print how many objects of each cache are in use, for ps.
+void
+slabdump(void)
+{
+  struct slabcache *c;
+  int i, n;
+
+  cprintf("Cache\tSize\tInUse\tSlabs\n");
+  for(c = caches; c; c = c->next){
+    n = c->nobj;
+    for(i = 0; i < NCPU; i++)
+      n -= c->mag[i].n;
+    cprintf("%s\t%d\t%d\t%d\n", c->name, c->size, n, c->nslab);
+  }
+}
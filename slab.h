@@ -0,0 +1,21 @@
+// A cache of same-sized kernel objects (slab.c).  Objects
+// are carved out of whole pages, the slabs; each cpu keeps a
+// magazine of free ones so most allocations take no lock.
+#define MAGSIZE 16  // objects in a full magazine
+
+struct magazine {
+  int n;                       // Objects held
+  void *obj[MAGSIZE];
+};
+
+struct slabcache {
+  struct spinlock lock;        // Protects the slabs
+  char *name;
+  uint size;                   // Object size, rounded up to a word
+  int perslab;                 // Objects in one slab
+  struct slab *partial;        // Slabs with free objects
+  int nslab;                   // Slabs allocated
+  int nobj;                    // Objects out of the slabs
+  struct magazine mag[NCPU];   // Free objects cached by each cpu
+  struct slabcache *next;      // On the list of all caches
+};
@@ -3,6 +3,7 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "syscall.h"
@@ -65,6 +66,11 @@ argptr(int n, char **pp, int size)
     return -1;
   if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
     return -1;
+  // Allocate the pages sbrk() handed out lazily now, and copy
+  // the copy-on-write ones, so running out of memory fails the
+  // call instead of a fault in the kernel.
+  if(lazyuvm(curproc->pgdir, i, size, curproc->sz) < 0)
+    return -1;
   *pp = (char*)i;
   return 0;
 }
@@ -106,6 +112,15 @@ extern int sys_uptime(void);
 extern int sys_waitx(void);
 extern int sys_procdetails(void);
 extern int sys_set_priority(void);
+extern int sys_set_tickets(void);
+extern int sys_set_deadline(void);
+extern int sys_set_affinity(void);
+extern int sys_get_affinity(void);
+extern int sys_set_clock(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -132,6 +147,15 @@ static int (*syscalls[])(void) = {
 [SYS_waitx]   sys_waitx,
 [SYS_procdetails]   sys_procdetails,
 [SYS_set_priority]   sys_set_priority,
+[SYS_set_tickets]   sys_set_tickets,
+[SYS_set_deadline]   sys_set_deadline,
+[SYS_set_affinity]   sys_set_affinity,
+[SYS_get_affinity]   sys_get_affinity,
+[SYS_set_clock]   sys_set_clock,
+[SYS_clone]   sys_clone,
+[SYS_join]   sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
 };
 
 void
@@ -22,4 +22,13 @@
 #define SYS_close  21
 #define SYS_waitx  22
 #define SYS_procdetails 23
-#define SYS_set_priority 24
\ No newline at end of file
+#define SYS_set_priority 24
+#define SYS_set_tickets 25
+#define SYS_set_deadline 26
+#define SYS_set_affinity 27
+#define SYS_get_affinity 28
+#define SYS_set_clock 29
+#define SYS_clone 30
+#define SYS_join 31
+#define SYS_futex_wait 32
+#define SYS_futex_wake 33
\ No newline at end of file
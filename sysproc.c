@@ -5,7 +5,9 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
+#include "timer.h"
 
 int
 sys_fork(void)
@@ -26,6 +28,48 @@ sys_wait(void)
   return wait();
 }
 
+int
+sys_clone(void)
+{
+  int fcn, arg1, arg2, stack;
+
+  if(argint(0, &fcn) < 0 || argint(1, &arg1) < 0)
+    return -1;
+  if(argint(2, &arg2) < 0 || argint(3, &stack) < 0)
+    return -1;
+  return clone((void(*)(void*, void*))fcn, (void*)arg1, (void*)arg2, (void*)stack);
+}
+
+int
+sys_join(void)
+{
+  void **stack;
+
+  if(argptr(0, (char**)&stack, sizeof(*stack)) < 0)
+    return -1;
+  return join(stack);
+}
+
+int
+sys_futex_wait(void)
+{
+  int *uaddr, val;
+
+  if(argptr(0, (char**)&uaddr, sizeof(*uaddr)) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(uaddr, val);
+}
+
+int
+sys_futex_wake(void)
+{
+  int *uaddr, n;
+
+  if(argptr(0, (char**)&uaddr, sizeof(*uaddr)) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(uaddr, n);
+}
+
 int
 sys_kill(void)
 {
@@ -56,22 +100,27 @@ sys_sbrk(void)
   return addr;
 }
 
+// Sleep for n ticks.  The timer wheel wakes us
+// when they have passed, not on every tick.
 int
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+  struct timer t;
 
   if(argint(0, &n) < 0)
     return -1;
+  if(n <= 0)
+    return 0;
   acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
+  timeradd(&t, ticks + n);
+  while(t.pending){
     if(myproc()->killed){
+      timerdel(&t);
       release(&tickslock);
       return -1;
     }
-    sleep(&ticks, &tickslock);
+    sleep(&t, &tickslock);
   }
   release(&tickslock);
   return 0;
@@ -125,4 +174,69 @@ sys_set_priority(void){
     return -1;
 
   return set_priority(new_priority, pid);
+}
+
+int
+sys_set_tickets(void){
+  int new_tickets;
+  int pid;
+
+  if(argint(0, &new_tickets) < 0)
+    return -1;
+
+  if(argint(1, &pid) < 0)
+    return -1;
+
+  return set_tickets(new_tickets, pid);
+}
+
+int
+sys_set_deadline(void){
+  int runtime, period, deadline;
+  int pid;
+
+  if(argint(0, &runtime) < 0 || argint(1, &period) < 0 || argint(2, &deadline) < 0)
+    return -1;
+
+  if(argint(3, &pid) < 0)
+    return -1;
+
+  return set_deadline(runtime, period, deadline, pid);
+}
+
+int
+sys_set_affinity(void){
+  int mask;
+  int pid;
+
+  if(argint(0, &mask) < 0)
+    return -1;
+
+  if(argint(1, &pid) < 0)
+    return -1;
+
+  return set_affinity(mask, pid);
+}
+
+int
+sys_get_affinity(void){
+  int pid;
+
+  if(argint(0, &pid) < 0)
+    return -1;
+
+  return get_affinity(pid);
+}
+
+int
+sys_set_clock(void){
+  int new_hz, new_quantum, new_tickless;
+
+  if(argint(0, &new_hz) < 0 || argint(1, &new_quantum) < 0)
+    return -1;
+
+  if(argint(2, &new_tickless) < 0)
+    return -1;
+
+  return set_clock(new_hz, new_quantum, new_tickless);
 }
\ No newline at end of file
@@ -0,0 +1,75 @@
+// Timer wheel.
+//
+// Pending timers are hashed by expiry tick into NWHEEL slots.
+// On each clock tick only the current slot is examined, so a
+// process in sleep(n) is woken once, when its time is up,
+// rather than on every tick to recheck.
+//
+// All timer state is protected by tickslock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "timer.h"
+
+#define NWHEEL 64  // slots; a power of two
+
+static struct timer *wheel[NWHEEL];
+
+// Arm t to fire at tick expires, which must be in the future.
+// Caller must hold tickslock.
+void
+timeradd(struct timer *t, uint expires)
+{
+  struct timer **slot;
+
+  if(!holding(&tickslock))
+    panic("timeradd");
+  if((int)(expires - ticks) <= 0)
+    panic("timeradd: expired");
+
+  t->expires = expires;
+  t->pending = 1;
+  slot = &wheel[expires % NWHEEL];
+  t->prev = 0;
+  t->next = *slot;
+  if(*slot)
+    (*slot)->prev = t;
+  *slot = t;
+}
+
+// Disarm t, if it has not fired yet.
+// Caller must hold tickslock.
+void
+timerdel(struct timer *t)
+{
+  if(!t->pending)
+    return;
+  if(t->prev)
+    t->prev->next = t->next;
+  else
+    wheel[t->expires % NWHEEL] = t->next;
+  if(t->next)
+    t->next->prev = t->prev;
+  t->next = t->prev = 0;
+  t->pending = 0;
+}
+
+// Fire the timers in this tick's slot that are due.
+// Timers hashed to the slot that are due in a later
+// round of the wheel stay where they are.
+// Called from the clock interrupt with tickslock held.
+void
+timerexpire(void)
+{
+  struct timer *t, *next;
+
+  for(t = wheel[ticks % NWHEEL]; t; t = next){
+    next = t->next;
+    if((int)(ticks - t->expires) >= 0){
+      timerdel(t);
+      wakeup(t);
+    }
+  }
+}
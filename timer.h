@@ -0,0 +1,9 @@
+// A one-shot kernel timer.  While pending it sits in the
+// timer wheel (timer.c); when ticks reaches expires it is
+// taken off and wakeup(t) is called.
+struct timer {
+  uint expires;          // Tick at which the timer fires
+  int pending;           // Still waiting to fire?
+  struct timer *next;    // Wheel slot links
+  struct timer *prev;
+};
@@ -3,10 +3,10 @@
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "x86.h"
 #include "traps.h"
-#include "spinlock.h"
 
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
@@ -36,6 +36,8 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
+  int rt, preempt;
+
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
@@ -46,15 +48,22 @@ trap(struct trapframe *tf)
     return;
   }
 
+  preempt = 0;
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
-      updateruntime();
-      wakeup(&ticks);
+      timerexpire();
       release(&tickslock);
     }
+    // Every cpu accounts for its own process.
+    updateruntime();
+    lapiceoi();
+    break;
+  case T_RESCHED:
+    // Another cpu queued work for us; see kick() in proc.c.
+    preempt = reschedintr();
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
@@ -79,6 +88,15 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // A write to a page fork() shared copy-on-write, or the
+    // first touch of a page sbrk() gave out, from user code or
+    // from the kernel copying to or from user memory.
+    if(myproc() && (cowfault(myproc()->pgdir, rcr2()) == 0 ||
+       lazyfault(myproc()->pgdir, rcr2(), myproc()->sz) == 0))
+      break;
+    // fall through
+
   //PAGEBREAK: 13
   default:
     if(myproc() == 0 || (tf->cs&3) == 0){
@@ -101,10 +119,17 @@ trap(struct trapframe *tf)
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
 
+  // A real-time process keeps the cpu until it has had its
+  // runtime for the period (see updateruntime), whatever the policy.
+  rt = myproc() && myproc()->rqlevel == RTLEVEL;
+  if(rt && myproc()->state == RUNNING &&
+     tf->trapno == T_IRQ0+IRQ_TIMER && myproc()->rtleft == 0)
+    yield();
+
 #ifndef FCFS
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
-  if(myproc() && myproc()->state == RUNNING &&
+  if(myproc() && myproc()->state == RUNNING && !rt &&
      tf->trapno == T_IRQ0+IRQ_TIMER){
 
     #ifdef MLFQ  
@@ -124,14 +149,23 @@ trap(struct trapframe *tf)
     else{
       myproc()->timeslice++;
     }
+    #elif defined(CFS)
+    // run out the slice the scheduler gave it (see scheduler)
+    if(++myproc()->timeslice >= myproc()->slice)
+      yield();
     #else
-    yield();
+    if(++myproc()->timeslice >= quantum)
+      yield();
     #endif
 
   }
+#endif
+
+  // A process that should preempt this one was queued here.
+  if(myproc() && myproc()->state == RUNNING && preempt)
+    yield();
 
   // Check if the process has been killed since we yielded
   if(myproc() && myproc()->killed && (tf->cs&3) == DPL_USER)
     exit();
-#endif
 }
@@ -26,6 +26,15 @@ int uptime(void);
 int waitx(int*, int*);
 void procdetails(void);
 int set_priority(int, int);
+int set_tickets(int, int);
+int set_deadline(int, int, int, int);
+int set_affinity(int, int);
+int get_affinity(int);
+int set_clock(int, int, int);
+int clone(void(*)(void*, void*), void*, void*, void*);
+int join(void**);
+int futex_wait(void*, int);
+int futex_wake(void*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -40,3 +49,29 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+
+// uthread.c
+typedef struct {
+  volatile uint locked;
+} lock_t;                   // spins while held
+
+typedef struct {
+  volatile uint locked;
+} mutex_t;                  // waits in the kernel while held
+
+typedef struct {
+  volatile uint seq;
+} cond_t;
+
+int thread_create(void(*)(void*, void*), void*, void*);
+int thread_join(void);
+void lock_init(lock_t*);
+void lock_acquire(lock_t*);
+void lock_release(lock_t*);
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
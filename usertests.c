@@ -1347,7 +1347,7 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
+  // more than the inode cache keeps unused (NINODE)
   for(i = 0; i < 50 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
@@ -1383,7 +1383,8 @@ forktest(void)
 
   printf(1, "fork test\n");
 
-  for(n=0; n<1000; n++){
+  // fails at the process limit, or when memory runs out
+  for(n=0; n<NPROC; n++){
     pid = fork();
     if(pid < 0)
       break;
@@ -1391,8 +1392,8 @@ forktest(void)
       exit();
   }
 
-  if(n == 1000){
-    printf(1, "fork claimed to work 1000 times!\n");
+  if(n == NPROC){
+    printf(1, "fork claimed to work NPROC times!\n");
     exit();
   }
 
@@ -1411,6 +1412,301 @@ forktest(void)
   printf(1, "fork test OK\n");
 }
 
+// fork() shares memory copy-on-write, but each side sees only its own writes.
+void
+cowtest(void)
+{
+  static char buf[3*4096];
+  int pid, fds[2], i;
+
+  printf(1, "cow test\n");
+
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'p';
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    close(fds[1]);
+    buf[0] = 'c';
+    if(read(fds[0], buf + 4096, 1) != 1 || buf[4096] != 'x'){
+      printf(1, "cow: read into shared page failed\n");
+      exit();
+    }
+    for(i = 1; i < sizeof(buf); i++){
+      if(i != 4096 && buf[i] != 'p'){
+        printf(1, "cow: child sees parent's write\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  close(fds[0]);
+  buf[2*4096] = 'q';
+  if(write(fds[1], "x", 1) != 1){
+    printf(1, "cow: write failed\n");
+    exit();
+  }
+  close(fds[1]);
+  wait();
+  if(buf[0] != 'p' || buf[4096] != 'p' || buf[2*4096] != 'q'){
+    printf(1, "cow: parent sees child's write\n");
+    exit();
+  }
+  printf(1, "cow test OK\n");
+}
+
+// a process can be pinned to a cpu, and its children inherit that.
+void
+affinitytest(void)
+{
+  int pid, old;
+
+  printf(1, "affinity test\n");
+
+  pid = getpid();
+  old = get_affinity(pid);
+  if(old <= 0){
+    printf(1, "get_affinity failed\n");
+    exit();
+  }
+  if(set_affinity(0, pid) != -1){
+    printf(1, "set_affinity accepted no cpus\n");
+    exit();
+  }
+  if(set_affinity(1, pid) != old || get_affinity(pid) != 1){
+    printf(1, "set_affinity failed\n");
+    exit();
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(get_affinity(getpid()) != 1)
+      printf(1, "affinity not inherited\n");
+    exit();
+  }
+  wait();
+
+  set_affinity(old, getpid());
+  printf(1, "affinity test OK\n");
+}
+
+// threads made by clone() share memory and open files, and can be joined.
+lock_t tlock;
+mutex_t tmutex;
+int tcount;
+
+void
+threadworker(void *n, void *m)
+{
+  int i;
+
+  for(i = 0; i < (int)n; i++){
+    lock_acquire(&tlock);
+    tcount++;
+    lock_release(&tlock);
+    mutex_lock(&tmutex);
+    tcount++;
+    mutex_unlock(&tmutex);
+  }
+  *(int*)m = getpid();
+  exit();
+}
+
+void
+threaddup(void *n, void *m)
+{
+  *(int*)m = dup(1);
+  exit();
+}
+
+void
+threadtest(void)
+{
+  int i, pid, pids[4], fd;
+
+  printf(1, "thread test\n");
+
+  lock_init(&tlock);
+  mutex_init(&tmutex);
+  tcount = 0;
+  for(i = 0; i < 4; i++){
+    pids[i] = 0;
+    if(thread_create(threadworker, (void*)1000, &pids[i]) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if((pid = thread_join()) < 0){
+      printf(1, "thread_join failed\n");
+      exit();
+    }
+  }
+  if(thread_join() != -1){
+    printf(1, "thread_join found too many\n");
+    exit();
+  }
+  if(wait() != -1){
+    printf(1, "wait reaped a thread\n");
+    exit();
+  }
+  if(tcount != 8000){
+    printf(1, "threads lost updates: %d\n", tcount);
+    exit();
+  }
+  for(i = 0; i < 4; i++){
+    if(pids[i] == 0){
+      printf(1, "thread did not run\n");
+      exit();
+    }
+  }
+
+  fd = -1;
+  if(thread_create(threaddup, 0, &fd) < 0 || thread_join() < 0){
+    printf(1, "thread_create failed\n");
+    exit();
+  }
+  if(fd < 0 || close(fd) < 0){
+    printf(1, "thread's fd not shared\n");
+    exit();
+  }
+
+  printf(1, "thread test OK\n");
+}
+
+// futex_wait only sleeps while the word holds the value given,
+// and condition variables built on it hand off between threads.
+cond_t fcond;
+int fturn;
+
+void
+futexworker(void *me, void *n)
+{
+  int i;
+
+  for(i = 0; i < (int)n; i++){
+    mutex_lock(&tmutex);
+    while(fturn != (int)me)
+      cond_wait(&fcond, &tmutex);
+    fturn = !fturn;
+    cond_signal(&fcond);
+    mutex_unlock(&tmutex);
+  }
+  exit();
+}
+
+void
+futextest(void)
+{
+  int i, word;
+
+  printf(1, "futex test\n");
+
+  word = 1;
+  if(futex_wait(&word, 0) != -1){
+    printf(1, "futex_wait slept on a changed word\n");
+    exit();
+  }
+  if(futex_wake(&word, 1) != 0){
+    printf(1, "futex_wake woke a non-waiter\n");
+    exit();
+  }
+  if(futex_wait((void*)0xfffffff0, 0) != -1){
+    printf(1, "futex_wait took a bad address\n");
+    exit();
+  }
+
+  mutex_init(&tmutex);
+  cond_init(&fcond);
+  fturn = 0;
+  for(i = 0; i < 2; i++){
+    if(thread_create(futexworker, (void*)i, (void*)100) < 0){
+      printf(1, "thread_create failed\n");
+      exit();
+    }
+  }
+  for(i = 0; i < 2; i++){
+    if(thread_join() < 0){
+      printf(1, "thread_join failed\n");
+      exit();
+    }
+  }
+
+  printf(1, "futex test OK\n");
+}
+
+// sbrk() only moves the break; pages are allocated when
+// first touched, by user code, by the kernel, or in a child.
+void
+lazytest(void)
+{
+  char *a, *p;
+  int fds[2], pid, i;
+
+  printf(1, "lazy test\n");
+
+  a = sbrk(0);
+  p = sbrk(64*4096);
+  if(p != a){
+    printf(1, "lazy: sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < 64*4096; i += 8*4096){
+    if(p[i] != 0){
+      printf(1, "lazy: new page not zero\n");
+      exit();
+    }
+  }
+  p[5*4096] = 'a';
+
+  if(pipe(fds) != 0){
+    printf(1, "pipe() failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(p[5*4096] != 'a' || p[9*4096] != 0){
+      printf(1, "lazy: child sees wrong memory\n");
+      exit();
+    }
+    p[33*4096] = 'c';
+    write(fds[1], &p[33*4096], 1);
+    exit();
+  }
+  wait();
+  if(read(fds[0], &p[63*4096 + 100], 1) != 1 || p[63*4096 + 100] != 'c'){
+    printf(1, "lazy: read into untouched page failed\n");
+    exit();
+  }
+  if(p[33*4096] != 0){
+    printf(1, "lazy: parent sees child's page\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+
+  if(sbrk(-64*4096) == (char*)0xffffffff || sbrk(0) != a){
+    printf(1, "lazy: sbrk could not shrink\n");
+    exit();
+  }
+  printf(1, "lazy test OK\n");
+}
+
 void
 sbrktest(void)
 {
@@ -1768,6 +2064,7 @@ main(int argc, char *argv[])
   bigargtest();
   bsstest();
   sbrktest();
+  lazytest();
   validatetest();
 
   opentest();
@@ -1793,6 +2090,10 @@ main(int argc, char *argv[])
   dirfile();
   iref();
   forktest();
+  cowtest();
+  affinitytest();
+  threadtest();
+  futextest();
   bigdir(); // slow
 
   uio();
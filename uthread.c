@@ -0,0 +1,142 @@
+#include "types.h"
+#include "stat.h"
+#include "param.h"
+#include "user.h"
+#include "x86.h"
+
+// Threads.  A thread is a process made by clone() that
+// shares the memory, open files and current directory of the
+// one that made it.  Each gets a one-page stack from malloc,
+// which thread_join frees.  malloc itself is not thread-safe:
+// call it under a lock.
+
+#define TSTACKSIZE 4096
+
+// What a new thread should run, kept at the bottom of its stack.
+struct tstart {
+  void (*fn)(void*, void*);
+  void *arg1;
+  void *arg2;
+};
+
+static void
+thread_start(void *a, void *unused)
+{
+  struct tstart *t = a;
+
+  t->fn(t->arg1, t->arg2);
+  exit();
+}
+
+// Start a thread running fn(arg1, arg2).
+// Returns its pid, or -1.
+int
+thread_create(void (*fn)(void*, void*), void *arg1, void *arg2)
+{
+  struct tstart *t;
+  int pid;
+
+  if((t = malloc(TSTACKSIZE)) == 0)
+    return -1;
+  t->fn = fn;
+  t->arg1 = arg1;
+  t->arg2 = arg2;
+  if((pid = clone(thread_start, t, 0, t)) < 0)
+    free(t);
+  return pid;
+}
+
+// Wait for one of this process's threads to finish.
+// Returns its pid, or -1 if there are none.
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(stack);
+  return pid;
+}
+
+void
+lock_init(lock_t *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(lock_t *lk)
+{
+  while(xchg(&lk->locked, 1) != 0)
+    ;
+  __sync_synchronize();
+}
+
+void
+lock_release(lock_t *lk)
+{
+  __sync_synchronize();
+  asm volatile("movl $0, %0" : "+m" (lk->locked) : );
+}
+
+// Mutexes wait with futex_wait when the lock is taken, so
+// an unlock only enters the kernel when someone is waiting.
+// locked is 0 when free, 1 when held, and 2 when held with
+// (possibly) a waiter.
+
+void
+mutex_init(mutex_t *m)
+{
+  m->locked = 0;
+}
+
+void
+mutex_lock(mutex_t *m)
+{
+  if(__sync_val_compare_and_swap(&m->locked, 0, 1) == 0)
+    return;
+  while(xchg(&m->locked, 2) != 0)
+    futex_wait((void*)&m->locked, 2);
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(xchg(&m->locked, 0) == 2)
+    futex_wake((void*)&m->locked, 1);
+}
+
+// Condition variables.  seq changes on every signal, so a
+// waiter that saw the old value cannot sleep through one sent
+// after it let go of the mutex.
+
+void
+cond_init(cond_t *c)
+{
+  c->seq = 0;
+}
+
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  uint seq = c->seq;
+
+  mutex_unlock(m);
+  futex_wait((void*)&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake((void*)&c->seq, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  __sync_fetch_and_add(&c->seq, 1);
+  futex_wake((void*)&c->seq, NPROC);
+}
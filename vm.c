@@ -4,12 +4,17 @@
 #include "x86.h"
 #include "memlayout.h"
 #include "mmu.h"
+#include "spinlock.h"
 #include "proc.h"
 #include "elf.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// Threads sharing a page table may fault on the same
+// untouched page at once; lazylock lets one of them map it.
+struct spinlock lazylock;
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -42,10 +47,9 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kalloc_zeroed()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -85,23 +89,28 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 // page protection bits prevent user code from using the kernel's
 // mappings.
 //
-// setupkvm() and exec() set up every page table like this:
+// setupkvm() and exec() set up every page table like this, with
+// the kernel's part shared with kpgdir and mapped by global 4 MB
+// pages where alignment allows (4 KB pages keep the kernel's
+// text read-only):
 //
 //   0..KERNBASE: user memory (text+data+stack+heap), mapped to
 //                phys memory allocated by the kernel
 //   KERNBASE..KERNBASE+EXTMEM: mapped to 0..EXTMEM (for I/O space)
 //   KERNBASE+EXTMEM..data: mapped to EXTMEM..V2P(data)
 //                for the kernel's instructions and r/o data
-//   data..KERNBASE+PHYSTOP: mapped to V2P(data)..PHYSTOP,
+//   data..KERNBASE+phystop: mapped to V2P(data)..phystop,
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
 // The kernel allocates physical memory for its heap and for user memory
-// between V2P(end) and the end of physical memory (PHYSTOP)
-// (directly addressable from end..P2V(PHYSTOP)).
+// between V2P(end) and the end of physical memory (phystop, found
+// at boot from the BIOS memory map; see kalloc.c)
+// (directly addressable from end..P2V(phystop)).
 
 // This table defines the kernel's mappings, which are present in
-// every process's page table.
+// every process's page table.  kvmalloc() sets where kernel
+// data+memory ends.
 static struct kmap {
   void *virt;
   uint phys_start;
@@ -114,24 +123,47 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
-// Set up kernel part of a page table.
+// Map the kernel range at va to pa in pgdir, global so its
+// TLB entries survive lcr3.  Uses a 4 MB page wherever va and
+// pa are both 4 MB aligned and a whole one fits, and 4 KB
+// pages around the edges.
+static int
+mapkpages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
+{
+  uint a, left;
+
+  a = (uint)va;
+  for(left = size; left > 0; ){
+    if(a % PGSIZE4M == 0 && pa % PGSIZE4M == 0 && left >= PGSIZE4M){
+      if(pgdir[PDX(a)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(a)] = pa | perm | PTE_P | PTE_PS | PTE_G;
+      a += PGSIZE4M;
+      pa += PGSIZE4M;
+      left -= PGSIZE4M;
+    } else {
+      if(mappages(pgdir, (void*)a, PGSIZE, pa, perm | PTE_G) < 0)
+        return -1;
+      a += PGSIZE;
+      pa += PGSIZE;
+      left -= PGSIZE;
+    }
+  }
+  return 0;
+}
+
+// Set up kernel part of a page table.  The kernel's page
+// tables are built once, in kpgdir, and shared by every page
+// directory, so this only copies kpgdir's kernel entries.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
-  if((pgdir = (pde_t*)kalloc()) == 0)
+  if((pgdir = (pde_t*)kalloc_zeroed()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
@@ -140,7 +172,20 @@ setupkvm(void)
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(k->virt == data)
+      k->phys_end = phystop;
+  initlock(&lazylock, "lazy");
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  if((kpgdir = (pde_t*)kalloc_zeroed()) == 0)
+    panic("kvmalloc");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkpages(kpgdir, k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm) < 0)
+      panic("kvmalloc");
   switchkvm();
 }
 
@@ -186,8 +231,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kalloc_zeroed();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -231,13 +275,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = kalloc_zeroed();
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -288,7 +331,7 @@ freevm(pde_t *pgdir)
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -323,10 +366,13 @@ copyuvm(pde_t *pgdir, uint sz)
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+    // Pages sbrk() has not allocated yet stay that way.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
     if((mem = kalloc()) == 0)
@@ -344,6 +390,206 @@ bad:
   return 0;
 }
 
+// Given a parent process's page table, make one for a child
+// that shares its pages copy-on-write: writable user pages
+// become read-only and PTE_COW in both, and are copied by
+// cowfault() on the first write.  Writable pages user code
+// cannot touch, like exec's guard page, are copied now, since
+// cowfault() only handles user pages.  pgdir must be the
+// current page table, and no other cpu may be using it.
+pde_t*
+cowuvm(pde_t *pgdir, uint sz)
+{
+  pde_t *d;
+  pte_t *pte;
+  uint pa, i;
+  char *mem;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  for(i = 0; i < sz; i += PGSIZE){
+    // Pages sbrk() has not allocated yet stay that way.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    pa = PTE_ADDR(*pte);
+    if((*pte & (PTE_W|PTE_U)) == PTE_W){
+      if((mem = kalloc()) == 0)
+        goto bad;
+      memmove(mem, (char*)P2V(pa), PGSIZE);
+      if(mappages(d, (void*)i, PGSIZE, V2P(mem), PTE_FLAGS(*pte)) < 0){
+        kfree(mem);
+        goto bad;
+      }
+      continue;
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    if(mappages(d, (void*)i, PGSIZE, pa, PTE_FLAGS(*pte)) < 0)
+      goto bad;
+    kref(P2V(pa));
+  }
+  lcr3(V2P(pgdir));  // flush the parent's writable mappings
+  return d;
+
+bad:
+  lcr3(V2P(pgdir));
+  freevm(d);
+  return 0;
+}
+
+// Give the copy-on-write page at *pte to this page table
+// alone and make it writable, copying it if it is still
+// shared.  Returns -1 if out of memory.
+static int
+cowpage(pte_t *pte)
+{
+  uint pa;
+  char *mem;
+
+  pa = PTE_ADDR(*pte);
+  if(krefcount(P2V(pa)) > 1){
+    if((mem = kalloc()) == 0)
+      return -1;
+    memmove(mem, (char*)P2V(pa), PGSIZE);
+    kfree(P2V(pa));
+    pa = V2P(mem);
+  }
+  *pte = pa | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  return 0;
+}
+
+// Handle a write fault at user address va in pgdir, the
+// current page table.  Returns 0 if it was a write to a
+// copy-on-write page, which is now writable, or -1 if the
+// access was bad or there is no memory to copy the page.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  if(va >= KERNBASE)
+    return -1;
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_U|PTE_COW)) != (PTE_P|PTE_U|PTE_COW))
+    return -1;
+  if(cowpage(pte) < 0)
+    return -1;
+  lcr3(V2P(pgdir));
+  return 0;
+}
+
+// Map a zeroed page at va in pgdir, if nothing is mapped
+// there yet.  Returns -1 if out of memory.
+static int
+lazypage(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+  char *mem;
+  int r;
+
+  r = -1;
+  acquire(&lazylock);
+  if((pte = walkpgdir(pgdir, (void*)va, 1)) == 0)
+    goto out;
+  if((*pte & PTE_P) == 0){
+    if((mem = kalloc_zeroed()) == 0)
+      goto out;
+    *pte = V2P(mem) | PTE_W | PTE_U | PTE_P;
+  }
+  r = 0;
+out:
+  release(&lazylock);
+  return r;
+}
+
+// Handle a fault at user address va in pgdir, a process of
+// size sz, on a page sbrk() gave it but nothing has touched
+// yet.  Returns 0 if a zeroed page is now mapped there, or -1
+// if the access was bad or there is no memory for the page.
+int
+lazyfault(pde_t *pgdir, uint va, uint sz)
+{
+  pte_t *pte;
+
+  if(va >= sz || va >= KERNBASE)
+    return -1;
+  if((pte = walkpgdir(pgdir, (void*)va, 0)) != 0 && (*pte & PTE_P))
+    return -1;
+  return lazypage(pgdir, PGROUNDDOWN(va));
+}
+
+// Map the pages from va to va+len in pgdir, the current page
+// table of a process of size sz, that nothing has touched yet,
+// and make the copy-on-write ones private, so the kernel can
+// use them without faulting.  Returns -1 if the range is not
+// within sz or there is no memory.
+int
+lazyuvm(pde_t *pgdir, uint va, uint len, uint sz)
+{
+  pte_t *pte;
+  uint a, last;
+  int r, copied;
+
+  if(len == 0)
+    return 0;
+  if(va >= sz || va + len > sz || va + len < va)
+    return -1;
+  r = copied = 0;
+  last = PGROUNDDOWN(va + len - 1);
+  for(a = PGROUNDDOWN(va); ; a += PGSIZE){
+    if(lazypage(pgdir, a) < 0){
+      r = -1;
+      break;
+    }
+    pte = walkpgdir(pgdir, (void*)a, 0);
+    if(*pte & PTE_COW){
+      if(cowpage(pte) < 0){
+        r = -1;
+        break;
+      }
+      copied = 1;
+    }
+    if(a == last)
+      break;
+  }
+  if(copied)
+    lcr3(V2P(pgdir));
+  return r;
+}
+
+// Make every copy-on-write page below sz private to pgdir,
+// before it is shared by threads: a fault could only flush
+// the TLB of the cpu it is taken on.  Returns -1 if out of
+// memory.
+int
+uncowuvm(pde_t *pgdir, uint sz)
+{
+  pte_t *pte;
+  uint i;
+  int copied;
+
+  copied = 0;
+  for(i = 0; i < sz; i += PGSIZE){
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_COW){
+      if(cowpage(pte) < 0)
+        return -1;
+      copied = 1;
+    }
+  }
+  if(copied)
+    lcr3(V2P(pgdir));
+  return 0;
+}
+
 //PAGEBREAK!
 // Map user virtual address to kernel address.
 char*
@@ -362,15 +608,28 @@ uva2ka(pde_t *pgdir, char *uva)
 // Copy len bytes from p to user address va in page table pgdir.
 // Most useful when pgdir is not the current page table.
 // uva2ka ensures this only works for PTE_U pages.
+// Writes go through the kernel's mapping of the page, so
+// copy-on-write pages are copied, and pages sbrk() has not
+// allocated yet are allocated, here rather than on a fault.
+// Callers check that va is within the process.
 int
 copyout(pde_t *pgdir, uint va, void *p, uint len)
 {
   char *buf, *pa0;
   uint n, va0;
+  pte_t *pte;
 
   buf = (char*)p;
   while(len > 0){
     va0 = (uint)PGROUNDDOWN(va);
+    if(va0 >= KERNBASE || lazypage(pgdir, va0) < 0)
+      return -1;
+    pte = walkpgdir(pgdir, (char*)va0, 0);
+    if((*pte & (PTE_P|PTE_U|PTE_COW)) == (PTE_P|PTE_U|PTE_COW)){
+      if(cowpage(pte) < 0)
+        return -1;
+      lcr3(rcr3());
+    }
     pa0 = uva2ka(pgdir, (char*)va0);
     if(pa0 == 0)
       return -1;
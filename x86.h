@@ -117,6 +117,25 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and wait for one.  sti takes effect only
+// after the following instruction, so no interrupt can be
+// taken between the two and leave the cpu halted.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
+// Index of the lowest set bit in v, which must be non-zero.
+static inline uint
+bsf(uint v)
+{
+  uint r;
+
+  asm volatile("bsf %1,%0" : "=r" (r) : "rm" (v));
+  return r;
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {
@@ -144,6 +163,14 @@ lcr3(uint val)
   asm volatile("movl %0,%%cr3" : : "r" (val));
 }
 
+static inline uint
+rcr3(void)
+{
+  uint val;
+  asm volatile("movl %%cr3,%0" : "=r" (val));
+  return val;
+}
+
 //PAGEBREAK: 36
 // Layout of the trap frame built on the stack by the
 // hardware and by trapasm.S, and passed to trap().